@@ -0,0 +1,99 @@
+// Module responsible for the Table microbenchmark.
+// Times the two workloads the compiler & runtime put on Table: interning identifiers & reading/writing a few names.
+// Build it against a revision of hashTable.c to compare, see bench/README.md.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../hashTable.h"
+#include "../object.h"
+
+#define INTERN_NAMES 50000
+#define INTERN_ROUNDS 20
+#define GLOBAL_NAMES 64
+#define GLOBAL_ROUNDS 200000
+
+static double wallClock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Distinct names shaped like identifiers. Only the Table API & hashString are used, so the benchmark builds against
+// older revisions of the table too.
+static String_Object** makeNames(const char* prefix, int count) {
+    String_Object** names = malloc(sizeof(String_Object*) * count);
+    char name[32];
+    for (int i = 0; i < count; i++) {
+        int length = snprintf(name, sizeof(name), "%s_%d", prefix, i);
+        names[i] = malloc(sizeof(String_Object));
+        names[i]->length = length;
+        names[i]->cString = malloc(length + 1);
+        memcpy(names[i]->cString, name, length + 1);
+        names[i]->hash = hashString(name, length);
+    }
+    return names;
+}
+
+static void freeNames(String_Object** names, int count) {
+    for (int i = 0; i < count; i++) {
+        free(names[i]->cString);
+        free(names[i]);
+    }
+    free(names);
+}
+
+// Every name is looked up by its characters & added when missing, then looked up again each round.
+static double internWorkload(String_Object** names) {
+    Table table;
+    initTable(&table);
+    double start = wallClock();
+    for (int round = 0; round <= INTERN_ROUNDS; round++) {
+        for (int i = 0; i < INTERN_NAMES; i++) {
+            String_Object* name = names[i];
+            if (tableFindString(&table, name->cString, name->length, name->hash) == NULL) {
+                tableSet(&table, MAKE_OBJ_STRING(name), MAKE_NONE);
+            }
+        }
+    }
+    double elapsed = wallClock() - start;
+    if (table.count != INTERN_NAMES) printf("Intern workload lost names: %d\n", table.count);
+    freeTable(&table);
+    return elapsed;
+}
+
+// A get & a set per round on one of a few names, like globals assigned in a loop.
+static double globalsWorkload(String_Object** names) {
+    Table table;
+    initTable(&table);
+    for (int i = 0; i < GLOBAL_NAMES; i++) {
+        tableSet(&table, MAKE_OBJ_STRING(names[i]), MAKE_NUMBER(0));
+    }
+    double start = wallClock();
+    for (int round = 0; round < GLOBAL_ROUNDS; round++) {
+        Value key = MAKE_OBJ_STRING(names[round % GLOBAL_NAMES]);
+        Value value;
+        tableGet(&table, key, &value);
+        tableSet(&table, key, MAKE_NUMBER(value.content.number_value + 1));
+    }
+    double elapsed = wallClock() - start;
+    Value value;
+    tableGet(&table, MAKE_OBJ_STRING(names[0]), &value);
+    if (value.content.number_value != GLOBAL_ROUNDS / GLOBAL_NAMES) printf("Globals workload lost writes.\n");
+    freeTable(&table);
+    return elapsed;
+}
+
+int main() {
+    String_Object** identifiers = makeNames("identifier", INTERN_NAMES);
+    String_Object** globals = makeNames("global", GLOBAL_NAMES);
+
+    printf("Intern:  %d names, %d lookups each: %.4fs\n", INTERN_NAMES, INTERN_ROUNDS + 1, internWorkload(identifiers));
+    printf("Globals: %d names, %d get/set pairs: %.4fs\n", GLOBAL_NAMES, GLOBAL_ROUNDS, globalsWorkload(globals));
+
+    freeNames(identifiers, INTERN_NAMES);
+    freeNames(globals, GLOBAL_NAMES);
+    return 0;
+}
@@ -2,6 +2,8 @@
 // Created by Congyu Luo on 9/25/22.
 //
 
+#include <string.h>
+
 #include "chunk.h"
 #include "memory.h"
 
@@ -10,17 +12,24 @@ void initChunk(Chunk* chunk) {
     chunk->current_index = 0;
     chunk->bytecode_array = NULL;
     initValueArray(&chunk->constant_array);
+    initValueArray(&chunk->global_names);
+    initValueArray(&chunk->memo_names);
+    chunk->max_stack_depth = 0;
+    chunk->verified = false;
 }
 
 void resetChunk(Chunk* chunk) {
     // Reset constant array
     resetValueArray(&chunk->constant_array);
+    resetValueArray(&chunk->global_names);
+    resetValueArray(&chunk->memo_names);
     // Reset bytecodes
     FREE_ARRAY(uint8_t, chunk->bytecode_array, chunk->size);
     initChunk(chunk);
 }
 
 void chunkAdd(Chunk* chunk, uint8_t code) {
+    chunk->verified = false;
     // Expand if needed
     if (chunk->current_index >= chunk->size) {
         int new_size = GROW_CAPACITY(chunk->size);
@@ -32,10 +41,135 @@ void chunkAdd(Chunk* chunk, uint8_t code) {
     chunk->current_index++;
 }
 
+// Same type & same bits, strings are interned so their pointers compare.
+static bool sameConstant(Value a, Value b) {
+    if (a.type != b.type) return false;
+    switch (a.type) {
+        case NUMBER_TYPE: return memcmp(&a.content.number_value, &b.content.number_value, sizeof(double)) == 0;
+        case INTEGER_TYPE: return a.content.integer_value == b.content.integer_value;
+        case BOOL_TYPE: return a.content.bool_value == b.content.bool_value;
+        case OBJECT_STRING_TYPE: return a.content.string_object == b.content.string_object;
+        case NONE_TYPE: return true;
+        default: return false;
+    }
+}
+
 void chunkAddConstant(Chunk* chunk, Value constant) {
+    for (int i = 0; i < chunk->constant_array.current_index; i++) {
+        if (sameConstant(chunk->constant_array.values[i], constant)) {
+            chunkAdd(chunk, i);
+            return;
+        }
+    }
     // Add constant to constant array
     int added_index = valueArrayAdd(&chunk->constant_array, constant);
     chunkAdd(chunk, added_index);
 }
 
 
+
+// Net change of the operand stack height caused by each instruction.
+// Calls are not covered, a call consumes its arguments once the callee returns.
+static const int8_t stack_effects[OP_CODE_COUNT] = {
+        [OP_CONSTANT] = 1,
+        [OP_NULL] = 1,
+        [OP_TRUE] = 1,
+        [OP_FALSE] = 1,
+        [OP_POP] = -1,
+        [OP_PEEK] = 1,
+        [OP_SQUASH] = 0, // Depends on its operand
+        [OP_GET_VAR] = 1,
+        [OP_GET_VAR_GLOBAL] = 1,
+        [OP_GET_GLOBAL] = 1,
+        [OP_SET_GLOBAL] = -1,
+        [OP_SET_VAR] = -1,
+        [OP_ASSIGN_LOCAL] = 0,
+        [OP_BUILD_LIST] = 0, // Depends on its operand
+        [OP_GET_INDEX] = -1,
+        [OP_SET_INDEX] = -3,
+        [OP_BUILD_MAP] = 0, // Depends on its operand
+        [OP_DELETE_KEY] = -2,
+        [OP_HAS_KEY] = -1,
+        [OP_UP_SCOPE] = 0,
+        [OP_DOWN_SCOPE] = 0,
+        [OP_EQUAL] = -1,
+        [OP_GREATER] = -1,
+        [OP_LESS] = -1,
+        [OP_ADD] = -1,
+        [OP_SUBTRACT] = -1,
+        [OP_MULTIPLY] = -1,
+        [OP_DIVIDE] = -1,
+        [OP_EXPONENT] = -1,
+        [OP_MOD] = -1,
+        [OP_ADD_NUM] = -1,
+        [OP_SUBTRACT_NUM] = -1,
+        [OP_MULTIPLY_NUM] = -1,
+        [OP_DIVIDE_NUM] = -1,
+        [OP_GREATER_NUM] = -1,
+        [OP_LESS_NUM] = -1,
+        [OP_ADD_NUM_GUARDED] = -1,
+        [OP_ADD_STR_GUARDED] = -1,
+        [OP_SUBTRACT_NUM_GUARDED] = -1,
+        [OP_MULTIPLY_NUM_GUARDED] = -1,
+        [OP_DIVIDE_NUM_GUARDED] = -1,
+        [OP_GREATER_NUM_GUARDED] = -1,
+        [OP_LESS_NUM_GUARDED] = -1,
+        [OP_NOT] = 0,
+        [OP_NEGATE] = 0,
+        [OP_PRINT] = -1,
+        [OP_PRINTLN] = -1,
+        [OP_JUMP] = 0,
+        [OP_JUMP_IF_FALSE] = 0,
+        [OP_JUMP_IF_FALSE_DISCARD] = -1,
+        [OP_JUMP_IF_TRUE] = 0,
+        [OP_LOOP] = 0,
+        [OP_FOR_RANGE_ENTER] = 0,
+        [OP_FOR_RANGE] = 0,
+        [OP_FOR_RANGE_ENTER_VAR] = 0,
+        [OP_FOR_RANGE_VAR] = 0,
+        [OP_CALL] = 0,
+        [OP_CALL_NATIVE] = 0, // Depends on the native's arity
+        [OP_TAIL_CALL] = 0, // Depends on its operand
+        [OP_MEMO_LOOKUP] = 0, // The key becomes a local
+        [OP_MEMO_STORE] = 0,
+        [OP_RA_PUSH] = 0,
+        [OP_RV_POP] = 1,
+        [OP_RETURN] = -1,
+};
+
+int stackEffect(uint8_t op) {
+    return stack_effects[op];
+}
+
+// Size in bytes of each instruction, operands included.
+static const uint8_t instruction_lengths[OP_CODE_COUNT] = {
+        [OP_CONSTANT] = 2,
+        [OP_PEEK] = 2,
+        [OP_SQUASH] = 2,
+        [OP_GET_VAR] = 3,
+        [OP_GET_VAR_GLOBAL] = 3,
+        [OP_GET_GLOBAL] = 2,
+        [OP_SET_GLOBAL] = 2,
+        [OP_SET_VAR] = 2,
+        [OP_ASSIGN_LOCAL] = 3,
+        [OP_BUILD_LIST] = 2,
+        [OP_BUILD_MAP] = 2,
+        [OP_UP_SCOPE] = 3,
+        [OP_JUMP] = 3,
+        [OP_JUMP_IF_FALSE] = 3,
+        [OP_JUMP_IF_FALSE_DISCARD] = 3,
+        [OP_JUMP_IF_TRUE] = 3,
+        [OP_FOR_RANGE_ENTER] = 6,
+        [OP_FOR_RANGE] = 6,
+        [OP_FOR_RANGE_ENTER_VAR] = 6,
+        [OP_FOR_RANGE_VAR] = 6,
+        [OP_CALL_NATIVE] = 2,
+        [OP_TAIL_CALL] = 4,
+        [OP_MEMO_LOOKUP] = 4,
+        [OP_MEMO_STORE] = 3,
+};
+
+int instructionLength(uint8_t op) {
+    int length = instruction_lengths[op];
+    return length == 0 ? 1 : length;
+}
@@ -14,13 +14,22 @@ typedef enum {
     OP_TRUE,
     OP_FALSE,
     OP_POP,
-    OP_GET_TYPE,
-    OP_GET_LEN,
-    OP_GET_TIME,
+    OP_PEEK,
+    OP_SQUASH,
     OP_GET_VAR,
+    OP_GET_VAR_GLOBAL,
+    OP_GET_GLOBAL,
     OP_SET_GLOBAL,
     OP_SET_VAR,
     OP_ASSIGN_LOCAL,
+    // Lists: items to build one from, list & index to read, list, index & value to write
+    OP_BUILD_LIST,
+    OP_GET_INDEX,
+    OP_SET_INDEX,
+    // Maps: key & value pairs to build one from, map & key to delete, key & map to look for
+    OP_BUILD_MAP,
+    OP_DELETE_KEY,
+    OP_HAS_KEY,
     OP_UP_SCOPE,
     OP_DOWN_SCOPE,
     OP_EQUAL,
@@ -32,6 +41,21 @@ typedef enum {
     OP_DIVIDE,
     OP_EXPONENT,
     OP_MOD,
+    // Operands proven to be numbers at compile time, no tag checks
+    OP_ADD_NUM,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
+    OP_GREATER_NUM,
+    OP_LESS_NUM,
+    // Rewritten from the generic opcodes at runtime, fall back to them once an operand doesn't match
+    OP_ADD_NUM_GUARDED,
+    OP_ADD_STR_GUARDED,
+    OP_SUBTRACT_NUM_GUARDED,
+    OP_MULTIPLY_NUM_GUARDED,
+    OP_DIVIDE_NUM_GUARDED,
+    OP_GREATER_NUM_GUARDED,
+    OP_LESS_NUM_GUARDED,
     OP_NOT,
     OP_NEGATE,
     OP_PRINT,
@@ -41,22 +65,55 @@ typedef enum {
     OP_JUMP_IF_FALSE_DISCARD,
     OP_JUMP_IF_TRUE,
     OP_LOOP,
+    // Range loops: counter, limit & step global slots, then a jump address.
+    // Entering checks the range & jumps to the exit if it's empty, stepping jumps back to the body while in range.
+    OP_FOR_RANGE_ENTER,
+    OP_FOR_RANGE,
+    // Same inside functions, the operands are the constant names of the locals
+    OP_FOR_RANGE_ENTER_VAR,
+    OP_FOR_RANGE_VAR,
     OP_CALL,
+    // Calls the runtime's native function at the operand's index, its arguments are replaced by the result
+    OP_CALL_NATIVE,
+    // Call replacing the current function's frame: operand count, function address
+    OP_TAIL_CALL,
+    // Memoized functions look their operands up on entry & cache their result before returning
+    OP_MEMO_LOOKUP,
+    OP_MEMO_STORE,
+    // Pushes the address after the OP_JUMP following it
     OP_RA_PUSH,
     OP_RV_POP,
     OP_RETURN,
+    OP_CODE_COUNT, // Must stay last
 } OpCode;
 
+// A compiled program. Frozen once verified: VMs only read it, so any number of them can run one chunk at once.
 typedef struct {
     int size;
     int current_index;
     uint8_t* bytecode_array;
     ValueArray constant_array;
+    // Names of global variables, indexed by their slot
+    ValueArray global_names;
+    // Operand stack slots needed by top level code
+    int max_stack_depth;
+    // Set once the verifier accepted the chunk
+    bool verified;
+    // Names of memoized functions, indexed by their memo table
+    ValueArray memo_names;
 } Chunk;
 
+// Instructions falling back this many times stay generic
+#define QUICKEN_DEOPT_LIMIT 4
+// Memo keys are built from at most this many operands
+#define MEMO_OPERAND_LIMIT 8
+
 void initChunk(Chunk* chunk);
 void resetChunk(Chunk* chunk);
 void chunkAdd(Chunk* chunk, uint8_t code);
+// Equal constants share one slot
 void chunkAddConstant(Chunk* chunk, Value constant);
+int stackEffect(uint8_t op);
+int instructionLength(uint8_t op);
 
 #endif //CJLANG_CHUNK_H
@@ -0,0 +1,105 @@
+// Module responsible for the embedding API.
+
+#include <string.h>
+
+#include "cjlang.h"
+#include "memory.h"
+#include "makeString.h"
+
+CJProgram* cjCompile(Runtime* runtime, const char* source, CompileOptions* options) {
+    CompileOptions defaults;
+    if (options == NULL) {
+        initCompileOptions(&defaults);
+        options = &defaults;
+    }
+    // The program outlives the VMs, none of them is charged for it
+    useHeap(NULL);
+    CJProgram* program = ALLOCATE(CJProgram, 1);
+    program->runtime = runtime;
+    initChunk(&program->chunk);
+    if (!compile(runtime, source, &program->chunk, options)) {
+        cjFreeProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+void cjFreeProgram(CJProgram* program) {
+    useHeap(NULL);
+    resetChunk(&program->chunk);
+    FREE(CJProgram, program);
+}
+
+void cjInitPool(CJPool* pool, const CJProgram* program) {
+    pool->program = program;
+    pool->idle = NULL;
+    pool->idle_count = 0;
+    pool->idle_capacity = 0;
+}
+
+void cjFreePool(CJPool* pool) {
+    // The VM structs & the idle array belong to the pool, not to any VM's heap
+    useHeap(NULL);
+    for (int i = 0; i < pool->idle_count; i++) {
+        VM* vm = pool->idle[i];
+        freeVM(vm);
+        FREE(VM, vm);
+    }
+    FREE_ARRAY(VM*, pool->idle, pool->idle_capacity);
+    cjInitPool(pool, pool->program);
+}
+
+VM* cjAcquireVM(CJPool* pool) {
+    if (pool->idle_count > 0) return pool->idle[--pool->idle_count];
+    useHeap(NULL);
+    // The heap's error flag points into the VM, so it never moves once initialized
+    VM* vm = ALLOCATE(VM, 1);
+    initVM(vm, pool->program->runtime, &pool->program->chunk);
+    return vm;
+}
+
+void cjReleaseVM(CJPool* pool, VM* vm) {
+    resetVM(vm);
+    useHeap(NULL);
+    if (pool->idle_count >= pool->idle_capacity) {
+        int new_capacity = GROW_CAPACITY(pool->idle_capacity);
+        pool->idle = GROW_ARRAY(VM*, pool->idle, pool->idle_capacity, new_capacity);
+        pool->idle_capacity = new_capacity;
+    }
+    pool->idle[pool->idle_count++] = vm;
+}
+
+// Slot of the global with this name, or -1. Global names are interned in the runtime.
+static int findGlobal(VM* vm, const char* name) {
+    String_Object* interned = findInternedString(&vm->runtime->strings, name, (int) strlen(name));
+    if (interned == NULL) return -1;
+    const ValueArray* names = &vm->chunk->global_names;
+    for (int i = 0; i < names->current_index; i++) {
+        if (names->values[i].content.string_object == interned) return i;
+    }
+    return -1;
+}
+
+bool cjSetGlobal(VM* vm, const char* name, Value value) {
+    int slot = findGlobal(vm, name);
+    if (slot < 0) return false;
+    vm->globals[slot].value = value;
+    vm->globals[slot].defined = true;
+    return true;
+}
+
+bool cjGetGlobal(VM* vm, const char* name, Value* value) {
+    int slot = findGlobal(vm, name);
+    if (slot < 0 || !vm->globals[slot].defined) return false;
+    *value = vm->globals[slot].value;
+    return true;
+}
+
+Value cjMakeString(VM* vm, const char* chars, int length) {
+    useHeap(&vm->heap);
+    return makeStrValue(&vm->strings, chars, length);
+}
+
+OperationResult cjRun(VM* vm) {
+    return run(vm);
+}
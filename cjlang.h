@@ -0,0 +1,47 @@
+// Module responsible for the embedding API.
+// A host compiles a script once into a program, then runs it on VMs taken from a pool, one run per VM at a time.
+// A pool & its VMs belong to the thread that created them, like the memory they allocate. A program is freed on the
+// thread that compiled it, until then the pools of every thread may share it.
+
+#ifndef CJLANG_CJLANG_H
+#define CJLANG_CJLANG_H
+
+#include "compiler.h"
+#include "vm.h"
+
+typedef struct {
+    Runtime* runtime;
+    Chunk chunk;
+} CJProgram;
+
+typedef struct {
+    const CJProgram* program;
+    // Released VMs, ready to run the program again
+    VM** idle;
+    int idle_count;
+    int idle_capacity;
+} CJPool;
+
+// Compiles source, NULL if it doesn't compile. options may be NULL for the defaults.
+// The program's strings are interned in runtime, which must outlive it.
+CJProgram* cjCompile(Runtime* runtime, const char* source, CompileOptions* options);
+// Free the pools running the program first
+void cjFreeProgram(CJProgram* program);
+
+void cjInitPool(CJPool* pool, const CJProgram* program);
+// Frees the idle VMs, release the others first
+void cjFreePool(CJPool* pool);
+// Returns a VM ready to run the program, reusing a released one when there is one
+VM* cjAcquireVM(CJPool* pool);
+// Resets the VM & keeps it for the next acquire, values read from it are no longer valid
+void cjReleaseVM(CJPool* pool, VM* vm);
+
+// Globals the host may set before a run & read after it.
+// False if the program never names the global, or when reading one that has no value.
+bool cjSetGlobal(VM* vm, const char* name, Value value);
+bool cjGetGlobal(VM* vm, const char* name, Value* value);
+// String to hand to the VM, valid until the VM is released
+Value cjMakeString(VM* vm, const char* chars, int length);
+OperationResult cjRun(VM* vm);
+
+#endif //CJLANG_CJLANG_H
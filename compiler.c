@@ -2,6 +2,8 @@
 // Created by Congyu Luo on 9/28/22.
 //
 
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,17 +13,202 @@
 #include "imports.h"
 #include "debugTools.h"
 #include "object.h"
+#include "verifier.h"
 #include "makeString.h"
+#include "memory.h"
+#include "ir.h"
 
 #define OPERAND_STACK_LIMIT 8
+// Largest function body in bytes inlined at call sites, and how deep inlined calls may nest
+#define INLINE_BUDGET 24
+#define INLINE_DEPTH_LIMIT 4
+// Local holding a memoized function's key, not a valid identifier
+#define MEMO_KEY_NAME "@memo"
+// Hidden variables holding hoisted loop invariants are named after the loop's depth & the expression's index in it.
+// Only loops nested in each other run at once, so loops after one another reuse the same variables
+#define HOIST_NAME_PREFIX "@hoist"
+// Hidden variables holding a range loop's limit & step are named after the loop's depth
+#define RANGE_LIMIT_PREFIX "@limit"
+#define RANGE_STEP_PREFIX "@step"
+// Failed passes over an outermost loop after which loop heads stop guessing the types of names the loop assigns
+#define LOOP_WIDEN_PASSES 2
+// Invariant depth of an expression changing in every loop
+#define VARIANT INT_MAX
 
 typedef struct {
+    String_Object* name;
+    StaticType type;
+} TypeBinding;
+
+// Variables whose type is known at a point of the program, on every path leading to it.
+// In function bodies these are the frame's locals, at the top level the globals.
+typedef struct {
+    TypeBinding* bindings;
+    int count;
+    int capacity;
+    // Set after a return, nothing flows from here to the next statement
+    bool unreachable;
+} TypeEnv;
+
+// Position in the source & code the compiler can go back to.
+// Loops are compiled again from there under weaker type assumptions, inlined calls read their callee's body there.
+typedef struct {
+    Tokenizer tokenizer;
+    Token current;
+    Token previous;
+    int code_index;
+    int constant_count;
+    int stack_depth;
+} CompilePoint;
+
+// Function whose body is a single `return <expression>;`, compiled again at each call site.
+typedef struct {
+    CompilePoint body; // Positioned on the return keyword
+    int operand_count;
+    String_Object* operands[OPERAND_STACK_LIMIT];
+} InlineBody;
+
+// Call being inlined, reads of its operands become EXPR_OPERAND nodes of the call.
+typedef struct {
+    InlineBody* callee;
+    ExprNode* call;
+    StaticType operand_types[OPERAND_STACK_LIMIT];
+} InlineFrame;
+
+// Call emitted before its function got defined, the definition patches the address in.
+typedef struct {
+    String_Object* function_name;
+    int patch_address;
+} ForwardCall;
+
+// Loop being compiled, nested loops of the same frame link to their enclosing one.
+typedef struct LoopScope {
+    struct LoopScope* enclosing;
+    int depth;
+    // Names assigned anywhere in the loop
+    Table assigned;
+    // Set once its invariant expressions got hoisted in front of it
+    bool hoisted;
+    // Hoisted expressions of enclosing loops stay active while compiling this one
+    int first_hoisted;
+    // Index of its LoopState
+    int state;
+} LoopScope;
+
+// What's known of a loop from the previous passes over the outermost loop holding it.
+// Only that outermost loop compiles its body again, nested loops start from what they settled on instead,
+// so each loop gets compiled a few times however deep it is.
+typedef struct {
+    const char* code; // Where the loop's header starts
+    // Types at its head, merged with every back edge so far
+    TypeEnv head;
+    bool has_head;
+    // Set once its invariants got picked, they're computed in front of it on the passes after
+    bool hoisted;
+    // Its invariant expressions found on the last pass, the ones hoisted once it's set
+    ExprNode** invariants;
+    int invariant_count;
+    int invariant_capacity;
+} LoopState;
+
+// Expression found not to change in a loop, it gets computed once in front of the loop.
+typedef struct {
+    ExprNode* node;
+    int code_index; // Where the code of the expression holding it starts
+    LoopScope* loop;
+} HoistCandidate;
+
+// Expression computed in front of its loop, the loop body reads the hidden variable holding it instead.
+typedef struct {
+    const char* code; // First token of the expression
+    Token last;
+    Value name;
+    StaticType type;
+    int invariant_depth;
+} HoistedExpression;
+
+// State of a compile, passed to every compiler function so separate compiles share nothing.
+typedef struct {
+    Tokenizer tokenizer;
+    // Chunk receiving the code, the runtime it's compiled in & that runtime's intern table
+    Chunk* chunk;
+    Runtime* runtime;
+    StringSet* strings;
     Token current;
     Token previous;
     bool hadError;
     bool panicMode;
     Table function_addrs;
     Table function_operands;
+    // Global name -> slot index
+    Table global_slots;
+    // Number of enclosing function definitions
+    int function_depth;
+    // Height of the temporaries on the operand stack in the frame being compiled, and its maximum
+    int stack_depth;
+    int max_stack_depth;
+    // Names living in the current function's frame, operands included, and the slots they take
+    Table frame_locals;
+    int frame_local_count;
+    // Addresses of the OP_GET_VAR instructions emitted in the enclosing functions
+    ValueArray get_var_sites;
+    // Static types of variables, of the expression just compiled & of the current function's returns
+    TypeEnv types;
+    StaticType expr_type;
+    StaticType return_type;
+    // Set when the function being compiled may assign globals
+    bool writes_globals;
+    Value function_name;
+    // Function name -> StaticType of its result
+    Table function_returns;
+    // Set when the function being compiled calls itself
+    bool calls_self;
+    // Small functions get inlined at call sites unless disabled
+    bool inlining;
+    // Function name -> index of its InlineBody
+    Table inline_functions;
+    InlineBody* inline_bodies;
+    int inline_body_count;
+    int inline_body_capacity;
+    InlineFrame* inline_frame;
+    int inline_depth;
+    // Functions that may assign globals, directly or through their calls
+    Table global_writers;
+    // Set when the function being compiled prints, reads the time or reads globals
+    bool impure;
+    // Functions that are neither impure nor assign globals, nor call a function that is
+    Table pure_functions;
+    // Function name -> index of its memo table
+    Table memo_slots;
+    // Memo table of the function being compiled, or -1
+    int memo_slot;
+    // Calls waiting for the definition of a function declared further down
+    ForwardCall* forward_calls;
+    int forward_call_count;
+    int forward_call_capacity;
+    // Trees of the expressions in the statement being compiled, and whether to print them
+    Arena ir;
+    bool dump_ir;
+    // Loop invariant expressions get hoisted out of their loops unless disabled
+    bool hoisting;
+    LoopScope* loop;
+    // Outermost loop being compiled, it compiles its body again until the types settled in every loop it holds
+    LoopScope* loop_driver;
+    // Set when the types at a loop head changed during the current pass, and how many passes failed so far
+    bool loop_retry;
+    int failed_loop_passes;
+    // Loops of the outermost one in the order they're met & the next one expected
+    LoopState* loop_states;
+    int loop_state_count;
+    int loop_state_capacity;
+    int loop_state_cursor;
+    HoistCandidate* hoist_candidates;
+    int hoist_candidate_count;
+    int hoist_candidate_capacity;
+    HoistedExpression* hoisted;
+    int hoisted_count;
+    int hoisted_capacity;
+    const char* source;
     Value operand_stack[OPERAND_STACK_LIMIT];
     int operand_stack_index;
     Value* operand_stackTop;
@@ -41,10 +228,8 @@ typedef enum {
     PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFn)();
-
-// Declare tokenizer instance
-Tokenizer tokenizer;
+// Prefix rules get no left operand
+typedef ExprNode* (*ParseFn)(Parser* parser, ExprNode* left);
 
 typedef struct {
     ParseFn prefix;
@@ -52,26 +237,144 @@ typedef struct {
     Precedence precedence;
 } ParseRule;
 
-Parser parser;
-Chunk *compilingChunk;
 
-static void initParser() {
-    parser.hadError = false;
-    parser.panicMode = false;
+static void initTypeEnv(TypeEnv* env) {
+    env->bindings = NULL;
+    env->count = 0;
+    env->capacity = 0;
+    env->unreachable = false;
+}
+
+static void freeTypeEnv(TypeEnv* env) {
+    FREE_ARRAY(TypeBinding, env->bindings, env->capacity);
+    initTypeEnv(env);
+}
+
+static void copyTypeEnv(TypeEnv* dest, TypeEnv* src) {
+    freeTypeEnv(dest);
+    if (src->count > 0) {
+        dest->bindings = ALLOCATE(TypeBinding, src->count);
+        memcpy(dest->bindings, src->bindings, sizeof(TypeBinding) * src->count);
+    }
+    dest->count = src->count;
+    dest->capacity = src->count;
+    dest->unreachable = src->unreachable;
+}
+
+static StaticType lookupType(TypeEnv* env, String_Object* name) {
+    if (env->unreachable) return TYPE_UNKNOWN;
+    for (int i = 0; i < env->count; i++) {
+        if (env->bindings[i].name == name) return env->bindings[i].type;
+    }
+    return TYPE_UNKNOWN;
+}
+
+static void bindType(TypeEnv* env, String_Object* name, StaticType type) {
+    for (int i = 0; i < env->count; i++) {
+        if (env->bindings[i].name != name) continue;
+        if (type == TYPE_UNKNOWN) {
+            env->bindings[i] = env->bindings[--env->count];
+        } else {
+            env->bindings[i].type = type;
+        }
+        return;
+    }
+    if (type == TYPE_UNKNOWN) return;
+    if (env->count >= env->capacity) {
+        int new_capacity = GROW_CAPACITY(env->capacity);
+        env->bindings = GROW_ARRAY(TypeBinding, env->bindings, env->capacity, new_capacity);
+        env->capacity = new_capacity;
+    }
+    env->bindings[env->count].name = name;
+    env->bindings[env->count].type = type;
+    env->count++;
+}
+
+static StaticType joinTypes(StaticType a, StaticType b) {
+    if (a == TYPE_NEVER) return b;
+    if (b == TYPE_NEVER) return a;
+    return a == b ? a : TYPE_UNKNOWN;
+}
+
+// Merges the types flowing in from another path, only what holds on both paths stays known.
+static void joinTypeEnv(TypeEnv* dest, TypeEnv* other) {
+    if (other->unreachable) return;
+    if (dest->unreachable) {
+        copyTypeEnv(dest, other);
+        return;
+    }
+    int kept = 0;
+    for (int i = 0; i < dest->count; i++) {
+        if (lookupType(other, dest->bindings[i].name) == dest->bindings[i].type) {
+            dest->bindings[kept++] = dest->bindings[i];
+        }
+    }
+    dest->count = kept;
+}
 
-    initTable(&parser.function_addrs);
-    initTable(&parser.function_operands);
-    parser.operand_stack_index = 0;
-    parser.operand_stackTop = &parser.operand_stack[0];
+static void initParser(Parser* parser) {
+    parser->hadError = false;
+    parser->panicMode = false;
+
+    initTable(&parser->function_addrs);
+    initTable(&parser->function_operands);
+    initTable(&parser->global_slots);
+    parser->function_depth = 0;
+    parser->stack_depth = 0;
+    parser->max_stack_depth = 0;
+    initTable(&parser->frame_locals);
+    parser->frame_local_count = 0;
+    initValueArray(&parser->get_var_sites);
+    initTypeEnv(&parser->types);
+    parser->expr_type = TYPE_UNKNOWN;
+    parser->return_type = TYPE_NEVER;
+    parser->writes_globals = false;
+    parser->function_name = MAKE_NONE;
+    initTable(&parser->function_returns);
+    initTable(&parser->global_writers);
+    parser->impure = false;
+    initTable(&parser->pure_functions);
+    initTable(&parser->memo_slots);
+    parser->memo_slot = -1;
+    parser->calls_self = false;
+    parser->inlining = true;
+    initTable(&parser->inline_functions);
+    parser->inline_bodies = NULL;
+    parser->inline_body_count = 0;
+    parser->inline_body_capacity = 0;
+    parser->inline_frame = NULL;
+    parser->inline_depth = 0;
+    parser->forward_calls = NULL;
+    parser->forward_call_count = 0;
+    parser->forward_call_capacity = 0;
+    parser->hoisting = true;
+    parser->loop = NULL;
+    parser->loop_driver = NULL;
+    parser->loop_retry = false;
+    parser->failed_loop_passes = 0;
+    parser->loop_states = NULL;
+    parser->loop_state_count = 0;
+    parser->loop_state_capacity = 0;
+    parser->loop_state_cursor = 0;
+    parser->hoist_candidates = NULL;
+    parser->hoist_candidate_count = 0;
+    parser->hoist_candidate_capacity = 0;
+    parser->hoisted = NULL;
+    parser->hoisted_count = 0;
+    parser->hoisted_capacity = 0;
+    initArena(&parser->ir);
+    parser->dump_ir = false;
+    parser->operand_stack_index = 0;
+    parser->operand_stackTop = &parser->operand_stack[0];
 }
 
-static Chunk *currentChunk() {
-    return compilingChunk;
+static Chunk *currentChunk(Parser* parser) {
+    return parser->chunk;
 }
 
-static void errorAt(Token *token, const char *message) {
-    if (parser.panicMode) return;
-    parser.panicMode = true;
+static void errorAt(Parser* parser, Token *token, const char *message) {
+    if (parser->panicMode) return;
+    parser->panicMode = true;
     fprintf(stderr, "[line %d] Error", token->line);
 
     if (token->type == EOF_T) {
@@ -83,264 +386,735 @@ static void errorAt(Token *token, const char *message) {
     }
 
     fprintf(stderr, ": %s\n", message);
-    parser.hadError = true;
+    parser->hadError = true;
 }
 
-static void error(const char *message) {
-    errorAt(&parser.previous, message);
+static void error(Parser* parser, const char *message) {
+    errorAt(parser, &parser->previous, message);
 }
 
-static void errorAtCurrent(const char *message) {
-    errorAt(&parser.current, message);
+static void errorAtCurrent(Parser* parser, const char *message) {
+    errorAt(parser, &parser->current, message);
 }
 
-static void stackPush(Value value) {
-    if (parser.operand_stack_index >= OPERAND_STACK_LIMIT){
-        errorAtCurrent("Operand stack limit reached.");
+static void stackPush(Parser* parser, Value value) {
+    if (parser->operand_stack_index >= OPERAND_STACK_LIMIT){
+        errorAtCurrent(parser, "Operand stack limit reached.");
     }
 
-    *parser.operand_stackTop = value;
-    parser.operand_stackTop++;
-    parser.operand_stack_index++;
+    *parser->operand_stackTop = value;
+    parser->operand_stackTop++;
+    parser->operand_stack_index++;
 }
 
-static Value stackPop() {
-    if (parser.operand_stack_index <= 0){
-        errorAtCurrent("Stack bottom reached.");
+static Value stackPop(Parser* parser) {
+    if (parser->operand_stack_index <= 0){
+        errorAtCurrent(parser, "Stack bottom reached.");
     }
 
-    parser.operand_stack_index--;
-    parser.operand_stackTop--;
-    return *parser.operand_stackTop;
+    parser->operand_stack_index--;
+    parser->operand_stackTop--;
+    return *parser->operand_stackTop;
 }
 
-static void advance() {
-    parser.previous = parser.current;
+static void advance(Parser* parser) {
+    parser->previous = parser->current;
 
     for (;;) {
-        parser.current = nextToken(&tokenizer);
+        parser->current = nextToken(&parser->tokenizer);
 #ifdef COMPILE_SHOW_TOKEN
-        if (parser.previous.type != EOF_T) printToken(parser.current);
+        if (parser->previous.type != EOF_T) printToken(parser->current);
 #endif
-        if (parser.current.type != ERROR_T) break;
+        if (parser->current.type != ERROR_T) break;
 
-        errorAtCurrent(parser.current.code);
+        errorAtCurrent(parser, parser->current.code);
     }
 }
 
-static void consume(TokenType type, const char *message) {
-    if (parser.current.type == type) {
-        advance();
+// Token after the current one, without consuming anything
+static Token peekToken(Parser* parser) {
+    Tokenizer tokenizer = parser->tokenizer;
+    return nextToken(&tokenizer);
+}
+
+static void consume(Parser* parser, TokenType type, const char *message) {
+    if (parser->current.type == type) {
+        advance(parser);
         return;
     }
 
-    errorAtCurrent(message);
+    errorAtCurrent(parser, message);
+}
+
+static void emitByte(Parser* parser, uint8_t byte) {
+    chunkAdd(currentChunk(parser), byte);
+}
+
+static void emitBytes(Parser* parser, uint8_t byte1, uint8_t byte2) {
+    emitByte(parser, byte1);
+    emitByte(parser, byte2);
+}
+
+static void adjustStackDepth(Parser* parser, int delta) {
+    parser->stack_depth += delta;
+    if (parser->stack_depth > parser->max_stack_depth) {
+        parser->max_stack_depth = parser->stack_depth;
+    }
 }
 
-static void emitByte(uint8_t byte) {
-    chunkAdd(currentChunk(), byte);
+// Emits an opcode & tracks its effect on the operand stack.
+static void emitOp(Parser* parser, uint8_t op) {
+    emitByte(parser, op);
+    adjustStackDepth(parser, stackEffect(op));
 }
 
-static void emitBytes(uint8_t byte1, uint8_t byte2) {
-    emitByte(byte1);
-    emitByte(byte2);
+static void emitReturn(Parser* parser) {
+    emitByte(parser, OP_RETURN);
 }
 
-static void emitReturn() {
-    emitByte(OP_RETURN);
+// Constants are referenced by a byte like global slots, the compile fails past 256 distinct ones.
+static void emitConstantOperand(Parser* parser, Value value) {
+    chunkAddConstant(currentChunk(parser), value);
+    if (currentChunk(parser)->constant_array.current_index > UINT8_MAX + 1) error(parser, "Too many constants.");
 }
 
-static void emitConstant(Value value) {
-    emitByte(OP_CONSTANT);
-    chunkAddConstant(currentChunk(), value);
+static void emitConstant(Parser* parser, Value value) {
+    emitOp(parser, OP_CONSTANT);
+    emitConstantOperand(parser, value);
 }
 
-static void emitBackJump(OpCode jumpOp, uint16_t address) {
-    Chunk* chunk = currentChunk();
+static void emitBackJump(Parser* parser, OpCode jumpOp, uint16_t address) {
+    Chunk* chunk = currentChunk(parser);
     chunkAdd(chunk, jumpOp);
+    adjustStackDepth(parser, stackEffect(jumpOp));
     chunkAdd(chunk, (address >> 8) & 0xff);
     chunkAdd(chunk, address & 0xff);
 }
 
-static int emitForwardJump(OpCode jumpOp) {
-    Chunk* chunk = currentChunk();
+static int emitForwardJump(Parser* parser, OpCode jumpOp) {
+    Chunk* chunk = currentChunk(parser);
     chunkAdd(chunk, jumpOp);
+    adjustStackDepth(parser, stackEffect(jumpOp));
     int curr_index = chunk->current_index;
     chunkAdd(chunk, 0xff);
     chunkAdd(chunk, 0xff);
     return curr_index;
 }
 
-static void patchForwardJump(int patchAddr) {
-    Chunk* chunk = currentChunk();
+static int emitFramePlaceholder(Parser* parser) {
+    int curr_index = currentChunk(parser)->current_index;
+    emitBytes(parser, 0xff, 0xff);
+    return curr_index;
+}
+
+static void patchFrameSize(Parser* parser, int patchAddr, int frame_size) {
+    if (frame_size > UINT16_MAX) {
+        error(parser, "Function frame too large.");
+        return;
+    }
+    Chunk* chunk = currentChunk(parser);
+    chunk->bytecode_array[patchAddr] = (frame_size >> 8) & 0xff;
+    chunk->bytecode_array[patchAddr + 1] = frame_size & 0xff;
+}
+
+static void patchForwardJump(Parser* parser, int patchAddr) {
+    Chunk* chunk = currentChunk(parser);
     int curr_addr = chunk->current_index;
     chunk->bytecode_array[patchAddr] = (curr_addr >> 8) & 0xff;
     chunk->bytecode_array[patchAddr + 1] = curr_addr & 0xff;
 }
 
-static void endCompiler() {
-    emitReturn();
+// Emits the address of a function, or a placeholder if it's only defined further down.
+static void emitFunctionAddress(Parser* parser, Value functionName) {
+    Value functionAddr;
+    if (tableGet(&parser->function_addrs, functionName, &functionAddr)) {
+        int address = (int) functionAddr.content.number_value;
+        emitBytes(parser, (address >> 8) & 0xff, address & 0xff);
+        return;
+    }
+    if (parser->forward_call_count >= parser->forward_call_capacity) {
+        int new_capacity = GROW_CAPACITY(parser->forward_call_capacity);
+        parser->forward_calls = GROW_ARRAY(ForwardCall, parser->forward_calls, parser->forward_call_capacity, new_capacity);
+        parser->forward_call_capacity = new_capacity;
+    }
+    ForwardCall* call = &parser->forward_calls[parser->forward_call_count++];
+    call->function_name = functionName.content.string_object;
+    call->patch_address = currentChunk(parser)->current_index;
+    emitBytes(parser, 0xff, 0xff);
 }
 
-static void expression();
-
-static ParseRule *getRule(TokenType type);
+static void patchForwardCalls(Parser* parser, Value functionName, int address) {
+    Chunk* chunk = currentChunk(parser);
+    int kept = 0;
+    for (int i = 0; i < parser->forward_call_count; i++) {
+        ForwardCall call = parser->forward_calls[i];
+        if (call.function_name != functionName.content.string_object) {
+            parser->forward_calls[kept++] = call;
+            continue;
+        }
+        chunk->bytecode_array[call.patch_address] = (address >> 8) & 0xff;
+        chunk->bytecode_array[call.patch_address + 1] = address & 0xff;
+    }
+    parser->forward_call_count = kept;
+}
 
-static void parsePrecedence(Precedence precedence);
+static uint8_t globalSlot(Parser* parser, Value name) {
+    Value slot;
+    if (tableGet(&parser->global_slots, name, &slot)) {
+        return (uint8_t) slot.content.number_value;
+    }
+    int index = currentChunk(parser)->global_names.current_index;
+    if (index > UINT8_MAX) {
+        error(parser, "Too many global variables.");
+        return 0;
+    }
+    valueArrayAdd(&currentChunk(parser)->global_names, name);
+    tableSet(&parser->global_slots, name, MAKE_NUMBER(index));
+    return (uint8_t) index;
+}
 
-static void statement();
+static uint8_t memoSlot(Parser* parser, Value functionName) {
+    Value slot;
+    if (tableGet(&parser->memo_slots, functionName, &slot)) {
+        return (uint8_t) slot.content.number_value;
+    }
+    int index = currentChunk(parser)->memo_names.current_index;
+    if (index > UINT8_MAX) {
+        error(parser, "Too many memoized functions.");
+        return 0;
+    }
+    valueArrayAdd(&currentChunk(parser)->memo_names, functionName);
+    tableSet(&parser->memo_slots, functionName, MAKE_NUMBER(index));
+    return (uint8_t) index;
+}
 
-static void functionCall();
+// Caches the result on top of the stack before a memoized function returns it.
+static void emitMemoStore(Parser* parser) {
+    if (parser->memo_slot < 0) return;
+    emitOp(parser, OP_MEMO_STORE);
+    emitByte(parser, parser->memo_slot);
+    emitConstantOperand(parser, makeStrValue(parser->strings, MEMO_KEY_NAME, sizeof(MEMO_KEY_NAME) - 1));
+}
 
-static void binary() {
-    TokenType operatorType = parser.previous.type;
-    ParseRule *rule = getRule(operatorType);
-    parsePrecedence((Precedence) (rule->precedence + 1));
+// A variable is invariant in the loops that don't assign it, as long as it's sure to be defined there.
+// In a function only its own locals qualify, any global may be assigned by a call.
+static int variableInvariantDepth(Parser* parser, Value name, StaticType type) {
+    if (parser->loop == NULL || type == TYPE_UNKNOWN || type == TYPE_NEVER) return VARIANT;
+    Value unused;
+    if (parser->function_depth > 0 && !tableGet(&parser->frame_locals, name, &unused)) return VARIANT;
+    for (LoopScope* loop = parser->loop; loop != NULL; loop = loop->enclosing) {
+        if (tableGet(&loop->assigned, name, &unused)) return loop->depth + 1;
+    }
+    return 1;
+}
 
+// Returns true if the operator can't fail on operands of these types.
+static bool operationSafe(TokenType operatorType, StaticType left, StaticType right) {
     switch (operatorType) {
         case PLUS_T:
         case PLUS_EQUAL_T:
-            emitByte(OP_ADD);
-            break;
-        case MINUS_T:
-        case MINUS_EQUAL_T:
-            emitByte(OP_SUBTRACT);
+            return left == right && (left == TYPE_NUMBER || left == TYPE_STRING);
+        case BANG_EQUAL_T:
+        case EQUAL_EQUAL_T:
+            return true;
+        default:
+            return left == TYPE_NUMBER && right == TYPE_NUMBER;
+    }
+}
+
+// More than a single constant or variable read, worth computing once before a loop.
+static bool isCompound(ExprNode* node) {
+    switch (node->kind) {
+        case EXPR_BINARY:
+        case EXPR_SQUARE:
+            return true;
+        case EXPR_NEGATE:
+            return isCompound(node->left);
+        default:
+            return false;
+    }
+}
+
+// Sets the depth of the outermost enclosing loop each node doesn't change in: it reads no variable that loop assigns,
+// and can't fail. Loops are numbered from 1 for the outermost one of the frame, VARIANT if it changes in all of them.
+// An inlined call's body isn't visited, none of it gets hoisted.
+static int invariantDepth(Parser* parser, ExprNode* node) {
+    int depth = VARIANT;
+    switch (node->kind) {
+        case EXPR_CONSTANT:
+            depth = 1;
             break;
-        case STAR_T:
-        case STAR_EQUAL_T:
-            emitByte(OP_MULTIPLY);
+        case EXPR_VARIABLE:
+            depth = variableInvariantDepth(parser, node->value, node->type);
             break;
-        case SLASH_T:
-        case SLASH_EQUAL_T:
-            emitByte(OP_DIVIDE);
+        case EXPR_HOISTED:
+            depth = node->invariant_depth;
             break;
-        case CARET_T:
-        case CARET_EQUAL_T:
-            emitByte(OP_EXPONENT);
+        case EXPR_BINARY: {
+            int left = invariantDepth(parser, node->left);
+            int right = invariantDepth(parser, node->right);
+            if (operationSafe(node->op, node->left->type, node->right->type)) depth = left > right ? left : right;
             break;
-        case MOD_T:
-        case MOD_EQUAL_T:
-            emitByte(OP_MOD);
+        }
+        case EXPR_SQUARE:
+        case EXPR_NEGATE: {
+            int operand = invariantDepth(parser, node->left);
+            if (node->left->type == TYPE_NUMBER || (node->kind == EXPR_NEGATE && node->left->type == TYPE_BOOL)) {
+                depth = operand;
+            }
             break;
-        case BANG_EQUAL_T:    emitBytes(OP_EQUAL, OP_NOT); break;
-        case EQUAL_EQUAL_T:   emitByte(OP_EQUAL); break;
-        case GREATER_T:       emitByte(OP_GREATER); break;
-        case GREATER_EQUAL_T: emitBytes(OP_LESS, OP_NOT); break;
-        case LESS_T:          emitByte(OP_LESS); break;
-        case LESS_EQUAL_T:    emitBytes(OP_GREATER, OP_NOT); break;
+        }
         default:
-            return; // Unreachable.
+            if (node->left != NULL && node->kind != EXPR_INLINE_CALL) invariantDepth(parser, node->left);
+            if (node->right != NULL) invariantDepth(parser, node->right);
+            for (ExprNode* arg = node->args; arg != NULL; arg = arg->next) {
+                invariantDepth(parser, arg);
+            }
+            break;
+    }
+    node->invariant_depth = depth;
+    return depth;
+}
+
+static void addHoistCandidate(Parser* parser, ExprNode* node) {
+    LoopScope* loop = parser->loop;
+    while (loop->depth > node->invariant_depth) loop = loop->enclosing;
+    // Its body is already compiled with its own invariants hoisted
+    if (loop->hoisted) return;
+    for (int i = 0; i < parser->hoist_candidate_count; i++) {
+        ExprNode* other = parser->hoist_candidates[i].node;
+        if (other->first.code == node->first.code && other->last.code == node->last.code) return;
+    }
+    if (parser->hoist_candidate_count >= parser->hoist_candidate_capacity) {
+        int new_capacity = GROW_CAPACITY(parser->hoist_candidate_capacity);
+        parser->hoist_candidates = GROW_ARRAY(HoistCandidate, parser->hoist_candidates, parser->hoist_candidate_capacity, new_capacity);
+        parser->hoist_candidate_capacity = new_capacity;
+    }
+    HoistCandidate* candidate = &parser->hoist_candidates[parser->hoist_candidate_count++];
+    candidate->node = node;
+    candidate->code_index = currentChunk(parser)->current_index;
+    candidate->loop = loop;
+}
+
+// Records the subexpressions that don't change in a loop their enclosing expression changes in,
+// each gets hoisted in front of the outermost such loop.
+static void considerHoisting(Parser* parser, ExprNode* node, int parent_depth) {
+    if (isCompound(node) && node->invariant_depth < parent_depth && node->invariant_depth <= parser->loop->depth) {
+        addHoistCandidate(parser, node);
+    }
+    if (node->left != NULL && node->kind != EXPR_INLINE_CALL) considerHoisting(parser, node->left, node->invariant_depth);
+    if (node->right != NULL) considerHoisting(parser, node->right, node->invariant_depth);
+    for (ExprNode* arg = node->args; arg != NULL; arg = arg->next) {
+        considerHoisting(parser, arg, node->invariant_depth);
+    }
+}
+
+static void findInvariants(Parser* parser, ExprNode* node) {
+    if (!parser->hoisting || parser->loop == NULL || parser->hadError) return;
+    invariantDepth(parser, node);
+    considerHoisting(parser, node, VARIANT);
+}
+
+static void emitGetVariable(Parser* parser, Value name) {
+    if (parser->function_depth > 0) {
+        // Could be a local, resolved at runtime with the global slot as fallback
+        valueArrayAdd(&parser->get_var_sites, MAKE_NUMBER(currentChunk(parser)->current_index));
+        emitOp(parser, OP_GET_VAR);
+        emitConstantOperand(parser, name);
+        emitByte(parser, globalSlot(parser, name));
+    } else {
+        emitOp(parser, OP_GET_GLOBAL);
+        emitByte(parser, globalSlot(parser, name));
+    }
+}
+
+static void emitSetVariable(Parser* parser, Value name, bool spec_global) {
+    if (spec_global || parser->function_depth == 0) {
+        emitOp(parser, OP_SET_GLOBAL);
+        emitByte(parser, globalSlot(parser, name));
+        if (parser->function_depth > 0) {
+            parser->writes_globals = true;
+        } else {
+            bindType(&parser->types, name.content.string_object, parser->expr_type);
+        }
+    } else {
+        emitOp(parser, OP_SET_VAR);
+        bindType(&parser->types, name.content.string_object, parser->expr_type);
+        emitConstantOperand(parser, name);
+        // Each name takes at most one stack slot in the frame
+        if (tableSet(&parser->frame_locals, name, MAKE_NONE)) parser->frame_local_count++;
+    }
+}
+
+// Once a function is compiled all names its frame can hold are known.
+// Reads of any other name always end up at the global slot, they skip the locals lookup.
+// Returns true if there were such reads.
+static bool resolveGlobalReads(Parser* parser, int first_site) {
+    bool reads_globals = false;
+    Chunk* chunk = currentChunk(parser);
+    for (int i = first_site; i < parser->get_var_sites.current_index; i++) {
+        int site = (int) parser->get_var_sites.values[i].content.number_value;
+        Value name = chunk->constant_array.values[chunk->bytecode_array[site + 1]];
+        Value unused;
+        if (!tableGet(&parser->frame_locals, name, &unused)) {
+            chunk->bytecode_array[site] = OP_GET_VAR_GLOBAL;
+            reads_globals = true;
+        }
     }
+    parser->get_var_sites.current_index = first_site;
+    return reads_globals;
 }
 
-static void grouping() {
-    expression();
-    consume(RIGHT_PAREN_T, "Expect ')' after expression.");
+static void endCompiler(Parser* parser) {
+    emitReturn(parser);
+    currentChunk(parser)->max_stack_depth = parser->max_stack_depth;
 }
 
-static void number() {
-    double value = strtod(parser.previous.code, NULL);
-    emitConstant(MAKE_NUMBER(value));
+static CompilePoint markCompilePoint(Parser* parser) {
+    CompilePoint point;
+    point.tokenizer = parser->tokenizer;
+    point.current = parser->current;
+    point.previous = parser->previous;
+    point.code_index = currentChunk(parser)->current_index;
+    point.constant_count = currentChunk(parser)->constant_array.current_index;
+    point.stack_depth = parser->stack_depth;
+    return point;
 }
 
-static void string() {
-    emitConstant(makeStrValue(copyString(parser.previous.code + 1, parser.previous.length - 2), parser.previous.length-2));
+static void restoreTokens(Parser* parser, CompilePoint* point) {
+    parser->tokenizer = point->tokenizer;
+    parser->current = point->current;
+    parser->previous = point->previous;
+}
+
+// Drops the code compiled since the point, the tokens stay where they are.
+static void rewindCode(Parser* parser, CompilePoint* point) {
+    currentChunk(parser)->current_index = point->code_index;
+    currentChunk(parser)->constant_array.current_index = point->constant_count;
+    parser->stack_depth = point->stack_depth;
+    ValueArray* sites = &parser->get_var_sites;
+    while (sites->current_index > 0 &&
+           sites->values[sites->current_index - 1].content.number_value >= point->code_index) {
+        sites->current_index--;
+    }
+    while (parser->forward_call_count > 0 &&
+           parser->forward_calls[parser->forward_call_count - 1].patch_address >= point->code_index) {
+        parser->forward_call_count--;
+    }
+    int kept = 0;
+    for (int i = 0; i < parser->hoist_candidate_count; i++) {
+        if (parser->hoist_candidates[i].code_index < point->code_index) {
+            parser->hoist_candidates[kept++] = parser->hoist_candidates[i];
+        }
+    }
+    parser->hoist_candidate_count = kept;
 }
 
-static void boolTrue() {
-    emitConstant(MAKE_BOOL(true));
+static void rewindTo(Parser* parser, CompilePoint* point) {
+    restoreTokens(parser, point);
+    rewindCode(parser, point);
 }
 
-static void boolFalse() {
-    emitConstant(MAKE_BOOL(false));
+// Continues with the tokens right after the given one.
+static void seekPast(Parser* parser, Token* token) {
+    parser->tokenizer.start = token->code + token->length;
+    parser->tokenizer.current_char = parser->tokenizer.start;
+    parser->tokenizer.line = token->line;
+    parser->current = *token;
+    advance(parser);
 }
 
-static void none() {
-    emitConstant(MAKE_NONE);
+static ExprNode* hoistedNode(Parser* parser, HoistedExpression* hoisted, Token first) {
+    ExprNode* node = newExprNode(&parser->ir, EXPR_HOISTED, first);
+    node->value = hoisted->name;
+    node->type = hoisted->type;
+    node->invariant_depth = hoisted->invariant_depth;
+    node->last = hoisted->last;
+    return node;
 }
 
-static void and_op() {
-    int patch = emitForwardJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
-    parsePrecedence(PREC_AND);
-    patchForwardJump(patch);
+// Reads the hidden variable instead of an expression hoisted out of the loop, the tokens continue after the expression.
+static ExprNode* substituteHoisted(Parser* parser) {
+    if (parser->inline_frame != NULL) return NULL;
+    for (int i = parser->hoisted_count - 1; i >= 0; i--) {
+        HoistedExpression* hoisted = &parser->hoisted[i];
+        if (hoisted->code != parser->current.code) continue;
+        ExprNode* node = hoistedNode(parser, hoisted, parser->current);
+        seekPast(parser, &hoisted->last);
+        return node;
+    }
+    return NULL;
 }
 
-static void or_op() {
-    int patch = emitForwardJump(OP_JUMP_IF_TRUE);
-    emitByte(OP_POP);
-    parsePrecedence(PREC_OR);
-    patchForwardJump(patch);
+// Same for a tree parsed on an earlier pass, before the enclosing loops hoisted parts of it.
+static ExprNode* readHoisted(Parser* parser, ExprNode* node) {
+    for (int i = parser->hoisted_count - 1; i >= 0; i--) {
+        HoistedExpression* hoisted = &parser->hoisted[i];
+        if (hoisted->code == node->first.code && hoisted->last.code == node->last.code) {
+            return hoistedNode(parser, hoisted, node->first);
+        }
+    }
+    if (node->left != NULL && node->kind != EXPR_INLINE_CALL) node->left = readHoisted(parser, node->left);
+    if (node->right != NULL) node->right = readHoisted(parser, node->right);
+    for (ExprNode** arg = &node->args; *arg != NULL; arg = &(*arg)->next) {
+        ExprNode* next = (*arg)->next;
+        *arg = readHoisted(parser, *arg);
+        (*arg)->next = next;
+    }
+    return node;
 }
 
-static void unary() {
-    TokenType operatorType = parser.previous.type;
+static ExprNode* parseExpression(Parser* parser);
+
+static void expression(Parser* parser);
+
+static ParseRule *getRule(TokenType type);
+
+static ExprNode* parsePrecedence(Parser* parser, Precedence precedence);
+
+static void statement(Parser* parser);
 
-    // Compile the operand.
-    parsePrecedence(PREC_UNARY);
+static ExprNode* callExpression(Parser* parser);
 
-    // Emit the operator instruction.
+static ExprNode* newNode(Parser* parser, ExprKind kind) {
+    return newExprNode(&parser->ir, kind, parser->previous);
+}
+
+static ExprNode* constantNode(Parser* parser, Value value) {
+    ExprNode* node = newNode(parser, EXPR_CONSTANT);
+    node->value = value;
+    node->type = constantType(value);
+    return node;
+}
+
+static ExprNode* binaryNode(Parser* parser, TokenType operatorType, ExprNode* left, ExprNode* right) {
+    ExprNode* node = newExprNode(&parser->ir, EXPR_BINARY, left->first);
+    node->op = operatorType;
+    node->left = left;
+    node->right = right;
+    // Unless they fail at runtime, arithmetic operators produce numbers & comparisons bools
+    node->type = TYPE_NUMBER;
     switch (operatorType) {
-        case MINUS_T:
-            emitByte(OP_NEGATE);
+        case PLUS_T:
+        case PLUS_EQUAL_T:
+            if (left->type == TYPE_STRING || right->type == TYPE_STRING) {
+                node->type = TYPE_STRING;
+            } else if (left->type != TYPE_NUMBER && right->type != TYPE_NUMBER) {
+                node->type = TYPE_UNKNOWN;
+            }
+            break;
+        case BANG_EQUAL_T:
+        case EQUAL_EQUAL_T:
+        case GREATER_T:
+        case GREATER_EQUAL_T:
+        case LESS_T:
+        case LESS_EQUAL_T:
+            node->type = TYPE_BOOL;
             break;
         default:
-            return; // Unreachable.
+            break;
     }
+    return node;
 }
 
-static void getIdentifier() {
-    Value identifierName = makeStrValue(copyString(parser.previous.code, parser.previous.length), parser.previous.length);
-    emitByte(OP_GET_VAR);
-    chunkAddConstant(currentChunk(), identifierName);
+static ExprNode* binary(Parser* parser, ExprNode* left) {
+    TokenType operatorType = parser->previous.type;
+    ParseRule *rule = getRule(operatorType);
+    ExprNode* right = parsePrecedence(parser, (Precedence) (rule->precedence + 1));
+    return binaryNode(parser, operatorType, left, right);
 }
 
-static void funcPrefixCall() {
-    functionCall();
-    emitByte(OP_RV_POP);
+static ExprNode* grouping(Parser* parser, ExprNode* left) {
+    ExprNode* node = parsePrecedence(parser, PREC_ASSIGNMENT);
+    consume(parser, RIGHT_PAREN_T, "Expect ')' after expression.");
+    return node;
 }
 
-static void identifier() {
-    Value identifierName = makeStrValue(copyString(parser.previous.code, parser.previous.length), parser.previous.length);
-    Value temp;
-    if (tableGet(&parser.function_addrs, identifierName, &temp)){
-        funcPrefixCall();
-    } else {
-        getIdentifier();
+static ExprNode* number(Parser* parser, ExprNode* left) {
+    // Literals without a fractional part are integers, unless too large for one
+    if (memchr(parser->previous.code, '.', parser->previous.length) == NULL) {
+        errno = 0;
+        long long value = strtoll(parser->previous.code, NULL, 10);
+        if (errno == 0) return constantNode(parser, MAKE_INTEGER(value));
+    }
+    double value = strtod(parser->previous.code, NULL);
+    return constantNode(parser, MAKE_NUMBER(value));
+}
+
+static ExprNode* string(Parser* parser, ExprNode* left) {
+    return constantNode(parser, makeStrValue(parser->strings, parser->previous.code + 1, parser->previous.length - 2));
+}
+
+static ExprNode* boolTrue(Parser* parser, ExprNode* left) {
+    return constantNode(parser, MAKE_BOOL(true));
+}
+
+static ExprNode* boolFalse(Parser* parser, ExprNode* left) {
+    return constantNode(parser, MAKE_BOOL(false));
+}
+
+static ExprNode* none(Parser* parser, ExprNode* left) {
+    return constantNode(parser, MAKE_NONE);
+}
+
+static ExprNode* logical(Parser* parser, ExprKind kind, ExprNode* left, Precedence precedence) {
+    ExprNode* node = newExprNode(&parser->ir, kind, left->first);
+    node->left = left;
+    node->right = parsePrecedence(parser, precedence);
+    // Either the left operand, a bool, or the right one
+    node->type = joinTypes(TYPE_BOOL, node->right->type);
+    return node;
+}
+
+static ExprNode* and_op(Parser* parser, ExprNode* left) {
+    return logical(parser, EXPR_AND, left, PREC_AND);
+}
+
+static ExprNode* or_op(Parser* parser, ExprNode* left) {
+    return logical(parser, EXPR_OR, left, PREC_OR);
+}
+
+static ExprNode* unary(Parser* parser, ExprNode* left) {
+    ExprNode* node = newNode(parser, EXPR_NEGATE);
+    node->left = parsePrecedence(parser, PREC_UNARY);
+    StaticType operand = node->left->type;
+    node->type = operand == TYPE_NUMBER || operand == TYPE_BOOL ? operand : TYPE_UNKNOWN;
+    return node;
+}
+
+static ExprNode* variable(Parser* parser, Value name) {
+    InlineFrame* frame = parser->inline_frame;
+    if (frame == NULL) {
+        // Known types are those of the frame's locals in a function, of the globals at the top level
+        ExprNode* node = newNode(parser, EXPR_VARIABLE);
+        node->value = name;
+        node->type = lookupType(&parser->types, name.content.string_object);
+        return node;
+    }
+    // Inside an inlined function body its operands are on the stack, any other name is a global
+    for (int i = 0; i < frame->callee->operand_count; i++) {
+        if (frame->callee->operands[i] != name.content.string_object) continue;
+        ExprNode* node = newNode(parser, EXPR_OPERAND);
+        node->value = name;
+        node->index = i;
+        node->call = frame->call;
+        node->type = frame->operand_types[i];
+        return node;
+    }
+    ExprNode* node = newNode(parser, EXPR_GLOBAL);
+    node->value = name;
+    node->type = parser->function_depth == 0 ? lookupType(&parser->types, name.content.string_object) : TYPE_UNKNOWN;
+    if (parser->function_depth > 0) parser->impure = true;
+    return node;
+}
+
+// Parses a call to a native function of the runtime, the VM hands it the arguments where they are on the stack.
+static ExprNode* nativeCall(Parser* parser, Value name, int index) {
+    const Native* native = &parser->runtime->natives[index];
+    ExprNode* call = newNode(parser, EXPR_NATIVE_CALL);
+    call->value = name;
+    call->index = index;
+    consume(parser, LEFT_PAREN_T, "Expect opening parenthesis.");
+    ExprNode** arg = &call->args;
+    while (parser->current.type != RIGHT_PAREN_T && parser->current.type != EOF_T) {
+        *arg = parseExpression(parser);
+        arg = &(*arg)->next;
+        if (parser->current.type != RIGHT_PAREN_T) {
+            consume(parser, COMMA_T, "Expect comma.");
+        }
+        call->arg_count++;
+    }
+    if (call->arg_count != native->arity) {
+        errorAtCurrent(parser, "Incorrect number of operands for function call.");
+    }
+    consume(parser, RIGHT_PAREN_T, "Expect closing parentheses.");
+    if (!native->pure) parser->impure = true;
+    return call;
+}
+
+// Parses a list literal, its items are evaluated in order & collected into a new list.
+static ExprNode* listLiteral(Parser* parser, ExprNode* left) {
+    ExprNode* node = newNode(parser, EXPR_LIST);
+    ExprNode** item = &node->args;
+    while (parser->current.type != RIGHT_BRACKET_T && parser->current.type != EOF_T) {
+        *item = parseExpression(parser);
+        item = &(*item)->next;
+        if (parser->current.type != RIGHT_BRACKET_T) {
+            consume(parser, COMMA_T, "Expect comma.");
+        }
+        node->arg_count++;
     }
+    consume(parser, RIGHT_BRACKET_T, "Expect closing bracket.");
+    if (node->arg_count > UINT8_MAX) error(parser, "Too many items in list literal.");
+    // Every evaluation makes a new list, a memoized call would hand out the same one
+    parser->impure = true;
+    return node;
 }
 
-static void typeFun() {
-    consume(LEFT_PAREN_T, "Expect opening parentheses.");
-    parsePrecedence(PREC_CALL);
-    consume(RIGHT_PAREN_T, "Expect closing parentheses.");
-    emitByte(OP_GET_TYPE);
+// Parses a map literal, its keys & values are evaluated in order & set into a new map.
+static ExprNode* mapLiteral(Parser* parser, ExprNode* left) {
+    ExprNode* node = newNode(parser, EXPR_MAP);
+    ExprNode** arg = &node->args;
+    while (parser->current.type != RIGHT_BRACE_T && parser->current.type != EOF_T) {
+        *arg = parseExpression(parser);
+        arg = &(*arg)->next;
+        consume(parser, COLON_T, "Expect colon after map key.");
+        *arg = parseExpression(parser);
+        arg = &(*arg)->next;
+        if (parser->current.type != RIGHT_BRACE_T) {
+            consume(parser, COMMA_T, "Expect comma.");
+        }
+        node->arg_count += 2;
+    }
+    consume(parser, RIGHT_BRACE_T, "Expect closing brace.");
+    if (node->arg_count / 2 > UINT8_MAX) error(parser, "Too many entries in map literal.");
+    parser->impure = true;
+    return node;
+}
+
+static ExprNode* contains(Parser* parser, ExprNode* left) {
+    ExprNode* node = newExprNode(&parser->ir, EXPR_CONTAINS, left->first);
+    node->left = left;
+    node->right = parsePrecedence(parser, PREC_TERM);
+    node->type = TYPE_BOOL;
+    return node;
 }
 
-static void lenFun() {
-    consume(LEFT_PAREN_T, "Expect opening parentheses.");
-    parsePrecedence(PREC_CALL);
-    consume(RIGHT_PAREN_T, "Expect closing parentheses.");
-    emitByte(OP_GET_LEN);
+static ExprNode* indexExpression(Parser* parser, ExprNode* left) {
+    ExprNode* node = newNode(parser, EXPR_INDEX);
+    node->left = left;
+    node->right = parseExpression(parser);
+    consume(parser, RIGHT_BRACKET_T, "Expect closing bracket.");
+    return node;
 }
 
-static void timeFun() {
-    consume(LEFT_PAREN_T, "Expect opening parentheses.");
-    consume(RIGHT_PAREN_T, "Expect closing parentheses.");
-    emitByte(OP_GET_TIME);
+static ExprNode* identifier(Parser* parser, ExprNode* left) {
+    Value identifierName = makeStrValue(parser->strings, parser->previous.code, parser->previous.length);
+    Value temp;
+    if (tableGet(&parser->function_operands, identifierName, &temp)){
+        return callExpression(parser);
+    }
+    // Functions of the script shadow natives of the same name, variables too unless called
+    if (parser->current.type == LEFT_PAREN_T && tableGet(&parser->runtime->native_names, identifierName, &temp)) {
+        return nativeCall(parser, identifierName, (int) temp.content.number_value);
+    }
+    return variable(parser, identifierName);
 }
 
 ParseRule rules[] = {
         [LEFT_PAREN_T]    = {grouping, NULL, PREC_CALL},
         [RIGHT_PAREN_T]   = {NULL, NULL, PREC_NONE},
-        [LEFT_BRACE_T]    = {NULL, NULL, PREC_NONE}, // [big]
+        [LEFT_BRACE_T]    = {mapLiteral, NULL, PREC_NONE},
         [RIGHT_BRACE_T]   = {NULL, NULL, PREC_NONE},
+        [LEFT_BRACKET_T]  = {listLiteral, indexExpression, PREC_CALL},
+        [RIGHT_BRACKET_T] = {NULL, NULL, PREC_NONE},
         [COMMA_T]         = {NULL, NULL, PREC_NONE},
         [DOT_T]           = {NULL, NULL, PREC_NONE},
         [MINUS_T]         = {unary, binary, PREC_TERM},
         [MINUS_EQUAL_T]         = {NULL, NULL, PREC_TERM},
         [PLUS_T]          = {NULL, binary, PREC_TERM},
         [PLUS_EQUAL_T]          = {NULL, NULL, PREC_TERM},
+        [COLON_T]         = {NULL, NULL, PREC_NONE},
         [SEMICOLON_T]     = {NULL, NULL, PREC_NONE},
         [SLASH_T]         = {NULL, binary, PREC_FACTOR},
         [SLASH_EQUAL_T]         = {NULL, NULL, PREC_FACTOR},
@@ -370,312 +1144,1246 @@ ParseRule rules[] = {
         [IF_T]            = {NULL, NULL, PREC_NONE},
         [NONE_T]           = {none, NULL, PREC_NONE},
         [OR_T]            = {NULL, or_op, PREC_OR},
-        [LEN_T]            = {lenFun, NULL, PREC_NONE},
         [PRINT_T]         = {NULL, NULL, PREC_NONE},
         [RETURN_T]        = {NULL, NULL, PREC_NONE},
         [TRUE_T]          = {boolTrue, NULL, PREC_NONE},
-        [TYPE_T]          = {typeFun, NULL, PREC_NONE},
         [VAR_T]           = {NULL, NULL, PREC_NONE},
         [WHILE_T]         = {NULL, NULL, PREC_NONE},
         [DEF_T]         = {NULL, NULL, PREC_NONE},
-        [TIME_T]         = {timeFun, NULL, PREC_NONE},
+        [DEL_T]           = {NULL, NULL, PREC_NONE},
+        [IN_T]            = {NULL, contains, PREC_COMPARISON},
+        [MEMO_T]         = {NULL, NULL, PREC_NONE},
         [ERROR_T]         = {NULL, NULL, PREC_NONE},
         [EOF_T]           = {NULL, NULL, PREC_NONE},
 };
 
-static void parsePrecedence(Precedence precedence) {
-    advance();
-    ParseFn prefixRule = getRule(parser.previous.type)->prefix;
-    if (prefixRule == NULL) {
-        error("Expect expression.");
-        return;
+static ExprNode* parsePrecedence(Parser* parser, Precedence precedence) {
+    Token first = parser->current;
+    ExprNode* node = parser->hoisted_count > 0 ? substituteHoisted(parser) : NULL;
+    if (node == NULL) {
+        advance(parser);
+        ParseFn prefixRule = getRule(parser->previous.type)->prefix;
+        if (prefixRule == NULL) {
+            error(parser, "Expect expression.");
+            return newExprNode(&parser->ir, EXPR_CONSTANT, first);
+        }
+        node = prefixRule(parser, NULL);
+        node->first = first;
+        node->last = parser->previous;
     }
 
-    prefixRule();
-
-    while (precedence <= getRule(parser.current.type)->precedence) {
-        advance();
-        ParseFn infixRule = getRule(parser.previous.type)->infix;
-        infixRule();
+    while (precedence <= getRule(parser->current.type)->precedence) {
+        // The expression so far becomes the left operand
+        advance(parser);
+        ParseFn infixRule = getRule(parser->previous.type)->infix;
+        node = infixRule(parser, node);
+        node->first = first;
+        node->last = parser->previous;
     }
+    return node;
 }
 
 static ParseRule *getRule(TokenType type) {
     return &rules[type];
 }
 
-static void expression() {
-    parsePrecedence(PREC_ASSIGNMENT);
+static void emitExpression(Parser* parser, ExprNode* node);
+
+static void emitBinary(Parser* parser, ExprNode* node) {
+    emitExpression(parser, node->left);
+    emitExpression(parser, node->right);
+    // Both operands proven to be numbers, the tag checks can be skipped
+    bool numbers = node->left->type == TYPE_NUMBER && node->right->type == TYPE_NUMBER;
+    switch (node->op) {
+        case PLUS_T:
+        case PLUS_EQUAL_T:    emitOp(parser, numbers ? OP_ADD_NUM : OP_ADD); break;
+        case MINUS_T:
+        case MINUS_EQUAL_T:   emitOp(parser, numbers ? OP_SUBTRACT_NUM : OP_SUBTRACT); break;
+        case STAR_T:
+        case STAR_EQUAL_T:    emitOp(parser, numbers ? OP_MULTIPLY_NUM : OP_MULTIPLY); break;
+        case SLASH_T:
+        case SLASH_EQUAL_T:   emitOp(parser, numbers ? OP_DIVIDE_NUM : OP_DIVIDE); break;
+        case CARET_T:
+        case CARET_EQUAL_T:   emitOp(parser, OP_EXPONENT); break;
+        case MOD_T:
+        case MOD_EQUAL_T:     emitOp(parser, OP_MOD); break;
+        case BANG_EQUAL_T:    emitOp(parser, OP_EQUAL); emitOp(parser, OP_NOT); break;
+        case EQUAL_EQUAL_T:   emitOp(parser, OP_EQUAL); break;
+        case GREATER_T:       emitOp(parser, numbers ? OP_GREATER_NUM : OP_GREATER); break;
+        case GREATER_EQUAL_T: emitOp(parser, numbers ? OP_LESS_NUM : OP_LESS); emitOp(parser, OP_NOT); break;
+        case LESS_T:          emitOp(parser, numbers ? OP_LESS_NUM : OP_LESS); break;
+        case LESS_EQUAL_T:    emitOp(parser, numbers ? OP_GREATER_NUM : OP_GREATER); emitOp(parser, OP_NOT); break;
+        default:
+            return; // Unreachable.
+    }
+}
+
+static void emitLogical(Parser* parser, ExprNode* node, OpCode jumpOp) {
+    emitExpression(parser, node->left);
+    int patch = emitForwardJump(parser, jumpOp);
+    emitOp(parser, OP_POP);
+    emitExpression(parser, node->right);
+    patchForwardJump(parser, patch);
 }
 
-static void printStatement() {
-    advance();
-    expression();
-    consume(SEMICOLON_T, "Expect end of statement.");
-    emitByte(OP_PRINT);
+static void emitArguments(Parser* parser, ExprNode* call) {
+    for (ExprNode* arg = call->args; arg != NULL; arg = arg->next) {
+        emitExpression(parser, arg);
+    }
 }
 
-static void printlnStatement() {
-    advance();
-    expression();
-    consume(SEMICOLON_T, "Expect end of statement.");
-    emitByte(OP_PRINTLN);
+// Jumps to the callee with the return address pushed, its result is then in the return value.
+static void emitCall(Parser* parser, ExprNode* call) {
+    emitArguments(parser, call);
+    emitOp(parser, OP_RA_PUSH);
+    emitOp(parser, OP_JUMP);
+    emitFunctionAddress(parser, call->value);
+    // The callee's frame takes ownership of the operands
+    adjustStackDepth(parser, -call->arg_count);
 }
 
-static void assignIdentidier(bool spec_global) {
-    advance();
-    Value identifierName = makeStrValue(copyString(parser.previous.code, parser.previous.length), parser.previous.length);
-    if (parser.current.type == EQUAL_T){
-        consume(EQUAL_T, "Expect assignment to identifier.");
-        expression();
-        consume(SEMICOLON_T, "Expect end of statement.");
-        if (spec_global){
-            emitByte(OP_SET_GLOBAL);
-        } else {
-            emitByte(OP_SET_VAR);
+// The callee's return expression runs in place of the call, reading its operands straight off the stack.
+static void emitInlineCall(Parser* parser, ExprNode* call) {
+    call->base_depth = parser->stack_depth;
+    emitArguments(parser, call);
+    emitExpression(parser, call->left);
+    // Drop the operands from under the result
+    if (call->arg_count > 0) {
+        emitOp(parser, OP_SQUASH);
+        emitByte(parser, call->arg_count);
+        adjustStackDepth(parser, -call->arg_count);
+    }
+}
+
+static void emitExpression(Parser* parser, ExprNode* node) {
+    switch (node->kind) {
+        case EXPR_CONSTANT:
+            emitConstant(parser, node->value);
+            break;
+        case EXPR_VARIABLE:
+        case EXPR_HOISTED:
+            emitGetVariable(parser, node->value);
+            break;
+        case EXPR_GLOBAL:
+            emitOp(parser, OP_GET_GLOBAL);
+            emitByte(parser, globalSlot(parser, node->value));
+            break;
+        case EXPR_OPERAND: {
+            int distance = parser->stack_depth - (node->call->base_depth + node->index);
+            emitOp(parser, OP_PEEK);
+            emitByte(parser, distance);
+            break;
         }
-        chunkAddConstant(currentChunk(), identifierName);
+        case EXPR_BINARY:
+            emitBinary(parser, node);
+            break;
+        case EXPR_SQUARE:
+            // Multiplies the operand with a copy of itself
+            emitExpression(parser, node->left);
+            emitOp(parser, OP_PEEK);
+            emitByte(parser, 1);
+            emitOp(parser, node->left->type == TYPE_NUMBER ? OP_MULTIPLY_NUM : OP_MULTIPLY);
+            break;
+        case EXPR_NEGATE:
+            emitExpression(parser, node->left);
+            emitOp(parser, OP_NEGATE);
+            break;
+        case EXPR_AND:
+            emitLogical(parser, node, OP_JUMP_IF_FALSE);
+            break;
+        case EXPR_OR:
+            emitLogical(parser, node, OP_JUMP_IF_TRUE);
+            break;
+        case EXPR_CALL:
+            emitCall(parser, node);
+            emitOp(parser, OP_RV_POP);
+            break;
+        case EXPR_INLINE_CALL:
+            emitInlineCall(parser, node);
+            break;
+        case EXPR_LIST:
+            emitArguments(parser, node);
+            emitOp(parser, OP_BUILD_LIST);
+            emitByte(parser, node->arg_count);
+            adjustStackDepth(parser, 1 - node->arg_count);
+            break;
+        case EXPR_INDEX:
+            emitExpression(parser, node->left);
+            emitExpression(parser, node->right);
+            emitOp(parser, OP_GET_INDEX);
+            break;
+        case EXPR_MAP:
+            emitArguments(parser, node);
+            emitOp(parser, OP_BUILD_MAP);
+            emitByte(parser, node->arg_count / 2);
+            adjustStackDepth(parser, 1 - node->arg_count);
+            break;
+        case EXPR_CONTAINS:
+            emitExpression(parser, node->left);
+            emitExpression(parser, node->right);
+            emitOp(parser, OP_HAS_KEY);
+            break;
+        case EXPR_NATIVE_CALL:
+            emitArguments(parser, node);
+            emitOp(parser, OP_CALL_NATIVE);
+            emitByte(parser, node->index);
+            // The result replaces the arguments
+            adjustStackDepth(parser, 1 - node->arg_count);
+            break;
+    }
+}
+
+static ExprNode* parseExpression(Parser* parser) {
+    return parsePrecedence(parser, PREC_ASSIGNMENT);
+}
+
+// Rewrites an expression's tree before it gets emitted, then records what's worth hoisting out of the enclosing loops.
+static void optimizeExpression(Parser* parser, ExprNode* node) {
+    foldConstants(node, parser->strings);
+    reduceStrength(node);
+    if (parser->dump_ir) {
+        printf("[%d] ", (int) (node->first.code - parser->source));
+        printExpr(node);
+        printf("\n");
+    }
+    findInvariants(parser, node);
+}
+
+static void expression(Parser* parser) {
+    ExprNode* node = parseExpression(parser);
+    optimizeExpression(parser, node);
+    emitExpression(parser, node);
+    parser->expr_type = node->type;
+}
+
+static void printStatement(Parser* parser) {
+    advance(parser);
+    expression(parser);
+    consume(parser, SEMICOLON_T, "Expect end of statement.");
+    emitOp(parser, OP_PRINT);
+    parser->impure = true;
+}
+
+static void printlnStatement(Parser* parser) {
+    advance(parser);
+    expression(parser);
+    consume(parser, SEMICOLON_T, "Expect end of statement.");
+    emitOp(parser, OP_PRINTLN);
+    parser->impure = true;
+}
+
+// Compiles `name[index]... = value;`, the last index gets written & the ones before it read.
+static void assignItem(Parser* parser, Token name, Value identifierName) {
+    ExprNode* target = variable(parser, identifierName);
+    target->first = name;
+    target->last = name;
+    advance(parser);
+    ExprNode* index = parseExpression(parser);
+    consume(parser, RIGHT_BRACKET_T, "Expect closing bracket.");
+    while (parser->current.type == LEFT_BRACKET_T) {
+        ExprNode* item = newNode(parser, EXPR_INDEX);
+        item->left = target;
+        item->right = index;
+        item->first = name;
+        target = item;
+        advance(parser);
+        index = parseExpression(parser);
+        consume(parser, RIGHT_BRACKET_T, "Expect closing bracket.");
+    }
+    consume(parser, EQUAL_T, "Expect assignment to list item.");
+    ExprNode* value = parseExpression(parser);
+    consume(parser, SEMICOLON_T, "Expect end of statement.");
+    ExprNode* operands[] = {target, index, value};
+    for (int i = 0; i < 3; i++) {
+        optimizeExpression(parser, operands[i]);
+        emitExpression(parser, operands[i]);
+    }
+    emitOp(parser, OP_SET_INDEX);
+    parser->impure = true;
+}
+
+// Compiles `del map[key];`, any expression ending with an index names the entry removed.
+static void deleteStatement(Parser* parser) {
+    advance(parser);
+    ExprNode* node = parseExpression(parser);
+    consume(parser, SEMICOLON_T, "Expect end of statement.");
+    if (node->kind != EXPR_INDEX) {
+        error(parser, "Can only delete map entries.");
+        return;
+    }
+    optimizeExpression(parser, node->left);
+    emitExpression(parser, node->left);
+    optimizeExpression(parser, node->right);
+    emitExpression(parser, node->right);
+    emitOp(parser, OP_DELETE_KEY);
+    parser->impure = true;
+}
+
+static void assignIdentidier(Parser* parser, bool spec_global) {
+    advance(parser);
+    Token name = parser->previous;
+    Value identifierName = makeStrValue(parser->strings, name.code, name.length);
+    if (parser->current.type == LEFT_BRACKET_T) {
+        assignItem(parser, name, identifierName);
+    } else if (parser->current.type == EQUAL_T){
+        consume(parser, EQUAL_T, "Expect assignment to identifier.");
+        expression(parser);
+        consume(parser, SEMICOLON_T, "Expect end of statement.");
+        emitSetVariable(parser, identifierName, spec_global);
     } else {
-        switch (parser.current.type) {
+        switch (parser->current.type) {
             case MINUS_EQUAL_T:
             case PLUS_EQUAL_T:
             case SLASH_EQUAL_T:
             case STAR_EQUAL_T:
             case CARET_EQUAL_T:
-            case MOD_EQUAL_T:
-                advance();
-                emitByte(OP_GET_VAR);
-                chunkAddConstant(currentChunk(), identifierName);
-                binary();
-                consume(SEMICOLON_T, "Expect end of statement.");
-                if (spec_global){
-                    emitByte(OP_SET_GLOBAL);
-                } else {
-                    emitByte(OP_SET_VAR);
-                }
-                chunkAddConstant(currentChunk(), identifierName);
+            case MOD_EQUAL_T: {
+                advance(parser);
+                TokenType operatorType = parser->previous.type;
+                ExprNode* target = variable(parser, identifierName);
+                target->first = name;
+                target->last = name;
+                ExprNode* operand = parsePrecedence(parser, (Precedence) (getRule(operatorType)->precedence + 1));
+                ExprNode* node = binaryNode(parser, operatorType, target, operand);
+                node->last = parser->previous;
+                consume(parser, SEMICOLON_T, "Expect end of statement.");
+                optimizeExpression(parser, node);
+                emitExpression(parser, node);
+                parser->expr_type = node->type;
+                emitSetVariable(parser, identifierName, spec_global);
                 break;
+            }
             default:
-                errorAtCurrent("Expect assignment to identifier.");
+                errorAtCurrent(parser, "Expect assignment to identifier.");
                 break;
         }
     }
 }
 
-static void group() {
-    advance();
-    while (!(parser.current.type == RIGHT_BRACE_T || parser.current.type == EOF_T)) {
-        statement();
+static void group(Parser* parser) {
+    advance(parser);
+    while (!(parser->current.type == RIGHT_BRACE_T || parser->current.type == EOF_T)) {
+        statement(parser);
     }
-    consume(RIGHT_BRACE_T, "Expect closing brace after group.");
+    consume(parser, RIGHT_BRACE_T, "Expect closing brace after group.");
 }
 
-static void ifStatement() {
-    advance();
-    consume(LEFT_PAREN_T, "Expect opening parenthesis.");
+static void ifStatement(Parser* parser) {
+    advance(parser);
+    consume(parser, LEFT_PAREN_T, "Expect opening parenthesis.");
     // Evaluate condition
-    expression();
-    consume(RIGHT_PAREN_T, "Expect closing parenthesis.");
+    expression(parser);
+    consume(parser, RIGHT_PAREN_T, "Expect closing parenthesis.");
     // Emit exit jump
-    int patch = emitForwardJump(OP_JUMP_IF_FALSE_DISCARD);
+    int patch = emitForwardJump(parser, OP_JUMP_IF_FALSE_DISCARD);
+    // Types when the body is skipped
+    TypeEnv skipped;
+    initTypeEnv(&skipped);
+    copyTypeEnv(&skipped, &parser->types);
     // Compile statement body
-    statement();
-    if (parser.current.type == ELSE_T) {
-        advance();
-        int else_patch = emitForwardJump(OP_JUMP);
-        patchForwardJump(patch);
-        statement();
-        patchForwardJump(else_patch);
+    statement(parser);
+    if (parser->current.type == ELSE_T) {
+        advance(parser);
+        int else_patch = emitForwardJump(parser, OP_JUMP);
+        patchForwardJump(parser, patch);
+        TypeEnv taken = parser->types;
+        parser->types = skipped;
+        statement(parser);
+        skipped = taken;
+        patchForwardJump(parser, else_patch);
+    } else {
+        patchForwardJump(parser, patch);
+    }
+    joinTypeEnv(&parser->types, &skipped);
+    freeTypeEnv(&skipped);
+}
+
+// Scans the tokens of a loop ahead of compiling it, collecting the names it assigns.
+typedef struct {
+    Tokenizer tokenizer;
+    Token previous;
+    Token current;
+} LoopScanner;
+
+static void scanToken(Parser* parser, LoopScanner* scanner, Table* assigned) {
+    scanner->previous = scanner->current;
+    scanner->current = nextToken(&scanner->tokenizer);
+    // A range loop assigns the variable following its keyword
+    if (scanner->previous.type == FOR_T && scanner->current.type == IDENTIFIER_T) {
+        tableSet(assigned, makeStrValue(parser->strings, scanner->current.code, scanner->current.length), MAKE_BOOL(true));
+        return;
+    }
+    if (scanner->previous.type != IDENTIFIER_T) return;
+    switch (scanner->current.type) {
+        case EQUAL_T:
+        case PLUS_EQUAL_T:
+        case MINUS_EQUAL_T:
+        case STAR_EQUAL_T:
+        case SLASH_EQUAL_T:
+        case CARET_EQUAL_T:
+        case MOD_EQUAL_T:
+            tableSet(assigned, makeStrValue(parser->strings, scanner->previous.code, scanner->previous.length), MAKE_BOOL(true));
+            break;
+        default:
+            break;
+    }
+}
+
+// Scans from an opening parenthesis or brace up to & including the one closing it.
+static void scanBracketed(Parser* parser, LoopScanner* scanner, Table* assigned) {
+    int depth = 0;
+    do {
+        switch (scanner->current.type) {
+            case LEFT_PAREN_T:
+            case LEFT_BRACE_T: depth++; break;
+            case RIGHT_PAREN_T:
+            case RIGHT_BRACE_T: depth--; break;
+            case EOF_T: return;
+            default: break;
+        }
+        scanToken(parser, scanner, assigned);
+    } while (depth > 0);
+}
+
+static void scanStatement(Parser* parser, LoopScanner* scanner, Table* assigned) {
+    switch (scanner->current.type) {
+        case LEFT_BRACE_T:
+            scanBracketed(parser, scanner, assigned);
+            return;
+        case IF_T:
+            scanToken(parser, scanner, assigned);
+            scanBracketed(parser, scanner, assigned);
+            scanStatement(parser, scanner, assigned);
+            if (scanner->current.type == ELSE_T) {
+                scanToken(parser, scanner, assigned);
+                scanStatement(parser, scanner, assigned);
+            }
+            return;
+        case WHILE_T:
+            scanToken(parser, scanner, assigned);
+            scanBracketed(parser, scanner, assigned);
+            scanStatement(parser, scanner, assigned);
+            return;
+        case FOR_T:
+            scanToken(parser, scanner, assigned);
+            // A range loop's header ends with range's parentheses
+            if (scanner->current.type == IDENTIFIER_T) {
+                while (scanner->current.type != LEFT_PAREN_T && scanner->current.type != EOF_T) {
+                    scanToken(parser, scanner, assigned);
+                }
+            }
+            scanBracketed(parser, scanner, assigned);
+            scanStatement(parser, scanner, assigned);
+            return;
+        case MEMO_T:
+        case DEF_T:
+            while (scanner->current.type != LEFT_PAREN_T && scanner->current.type != EOF_T) {
+                scanToken(parser, scanner, assigned);
+            }
+            scanBracketed(parser, scanner, assigned);
+            scanBracketed(parser, scanner, assigned);
+            return;
+        default:
+            while (scanner->current.type != SEMICOLON_T && scanner->current.type != EOF_T) {
+                if (scanner->current.type == LEFT_PAREN_T) {
+                    scanBracketed(parser, scanner, assigned);
+                } else {
+                    scanToken(parser, scanner, assigned);
+                }
+            }
+            scanToken(parser, scanner, assigned);
+            return;
+    }
+}
+
+// Finds the state of a loop met again on a new pass, loops come in the same order on every pass.
+static int loopState(Parser* parser, const char* code) {
+    int cursor = parser->loop_state_cursor;
+    if (cursor >= parser->loop_state_count || parser->loop_states[cursor].code != code) {
+        for (cursor = 0; cursor < parser->loop_state_count; cursor++) {
+            if (parser->loop_states[cursor].code == code) break;
+        }
+    }
+    if (cursor == parser->loop_state_count) {
+        if (parser->loop_state_count >= parser->loop_state_capacity) {
+            int new_capacity = GROW_CAPACITY(parser->loop_state_capacity);
+            parser->loop_states = GROW_ARRAY(LoopState, parser->loop_states, parser->loop_state_capacity, new_capacity);
+            parser->loop_state_capacity = new_capacity;
+        }
+        LoopState* state = &parser->loop_states[parser->loop_state_count++];
+        state->code = code;
+        initTypeEnv(&state->head);
+        state->has_head = false;
+        state->hoisted = false;
+        state->invariants = NULL;
+        state->invariant_count = 0;
+        state->invariant_capacity = 0;
+    }
+    parser->loop_state_cursor = cursor + 1;
+    return cursor;
+}
+
+static void freeLoopStates(Parser* parser) {
+    for (int i = 0; i < parser->loop_state_count; i++) {
+        LoopState* state = &parser->loop_states[i];
+        freeTypeEnv(&state->head);
+        FREE_ARRAY(ExprNode*, state->invariants, state->invariant_capacity);
+    }
+    parser->loop_state_count = 0;
+}
+
+// Enters a loop positioned on the parenthesis after its keyword, or on the body of a loop whose header runs once.
+static void beginLoop(Parser* parser, LoopScope* loop, bool header) {
+    loop->enclosing = parser->loop;
+    loop->depth = parser->loop == NULL ? 1 : parser->loop->depth + 1;
+    loop->hoisted = false;
+    loop->first_hoisted = parser->hoisted_count;
+    if (parser->loop_driver == NULL) {
+        parser->loop_driver = loop;
+        parser->failed_loop_passes = 0;
+    }
+    loop->state = loopState(parser, parser->current.code);
+    initTable(&loop->assigned);
+    LoopScanner scanner;
+    scanner.tokenizer = parser->tokenizer;
+    scanner.current = parser->current;
+    if (header) scanBracketed(parser, &scanner, &loop->assigned);
+    scanStatement(parser, &scanner, &loop->assigned);
+    parser->loop = loop;
+}
+
+static void endLoop(Parser* parser, LoopScope* loop) {
+    parser->loop = loop->enclosing;
+    parser->hoisted_count = loop->first_hoisted;
+    int kept = 0;
+    for (int i = 0; i < parser->hoist_candidate_count; i++) {
+        if (parser->hoist_candidates[i].loop != loop) parser->hoist_candidates[kept++] = parser->hoist_candidates[i];
+    }
+    parser->hoist_candidate_count = kept;
+    freeTable(&loop->assigned);
+    if (parser->loop_driver == loop) {
+        parser->loop_driver = NULL;
+        freeLoopStates(parser);
+    }
+}
+
+static void addHoisted(Parser* parser, ExprNode* node, LoopScope* loop, Value name) {
+    if (parser->hoisted_count >= parser->hoisted_capacity) {
+        int new_capacity = GROW_CAPACITY(parser->hoisted_capacity);
+        parser->hoisted = GROW_ARRAY(HoistedExpression, parser->hoisted, parser->hoisted_capacity, new_capacity);
+        parser->hoisted_capacity = new_capacity;
+    }
+    HoistedExpression* hoisted = &parser->hoisted[parser->hoisted_count++];
+    hoisted->code = node->first.code;
+    hoisted->last = node->last;
+    hoisted->name = name;
+    hoisted->type = node->type;
+    hoisted->invariant_depth = loop->depth;
+}
+
+// Computes the invariant expressions of a loop in front of it into hidden variables, the loop body reads those instead.
+static void emitHoisted(Parser* parser, LoopScope* loop, LoopState* state) {
+    // Hoisted code runs in the enclosing loop, parts of it may not change there either
+    parser->loop = loop->enclosing;
+    for (int i = 0; i < state->invariant_count; i++) {
+        ExprNode* node = readHoisted(parser, state->invariants[i]);
+        state->invariants[i] = node;
+        findInvariants(parser, node);
+        emitExpression(parser, node);
+        parser->expr_type = node->type;
+        char name[32];
+        int length = snprintf(name, sizeof(name), HOIST_NAME_PREFIX "%d_%d", loop->depth, i);
+        Value hidden = makeStrValue(parser->strings, name, length);
+        emitSetVariable(parser, hidden, false);
+        addHoisted(parser, node, loop, hidden);
+    }
+    parser->loop = loop;
+}
+
+// Starts a pass over a loop, with its hoisted expressions computed first once they're picked.
+// Its head gets the types it settled on in the previous passes, so a nested loop needs no pass of its own to settle.
+static void beginLoopPass(Parser* parser, LoopScope* loop, TypeEnv* head) {
+    LoopState* state = &parser->loop_states[loop->state];
+    if (parser->loop_driver == loop) {
+        parser->loop_state_cursor = loop->state + 1;
+        parser->loop_retry = false;
+    }
+    parser->hoisted_count = loop->first_hoisted;
+    loop->hoisted = state->hoisted;
+    if (state->hoisted) {
+        emitHoisted(parser, loop, state);
     } else {
-        patchForwardJump(patch);
-    }
-}
-
-static void whileStatement() {
-    advance();
-    consume(LEFT_PAREN_T, "Expect opening parenthesis.");
-    // Store condition evaluation address
-    int eval_address = currentChunk()->current_index;
-    expression();
-    consume(RIGHT_PAREN_T, "Expect closing parenthesis.");
-    // Jump based on evaluated condition
-    int patch = emitForwardJump(OP_JUMP_IF_FALSE_DISCARD);
-    // Statement body
-    statement();
-    // Loopback
-    emitBackJump(OP_JUMP, eval_address);
-    // Patch exit condition address
-    patchForwardJump(patch);
-}
-
-static void forStatement() {
-    advance();
-    consume(LEFT_PAREN_T, "Expect opening parenthesis.");
-    int condition_addr = currentChunk()->current_index;
-    // Condition
-    expression();
-    consume(SEMICOLON_T, "Expect ';'.");
-    int exit_patch = emitForwardJump(OP_JUMP_IF_FALSE_DISCARD);
-    int body_patch = emitForwardJump(OP_JUMP);
-    // Increment operation
-    int increment_addr = currentChunk()->current_index;
-    statement();
-    emitBackJump(OP_JUMP, condition_addr);
-    consume(RIGHT_PAREN_T, "Expect closing parenthesis.");
-    // Body statement
-    patchForwardJump(body_patch);
-    statement();
-    // Evaluate back jump.
-    emitBackJump(OP_JUMP, increment_addr);
-    patchForwardJump(exit_patch);
-}
-
-static void defineStatement() {
-    if (parser.operand_stack_index != 0) {
-        errorAtCurrent("Internal failure, operand stack not empty.");
-    }
-    advance();
-    if (parser.current.type != IDENTIFIER_T) {
-        errorAtCurrent("Require function identifier.");
+        state->invariant_count = 0;
+    }
+    copyTypeEnv(head, &parser->types);
+    if (state->has_head) joinTypeEnv(head, &state->head);
+    // Types weakening one pass at a time would take as many passes as the loop has variables
+    if (parser->failed_loop_passes >= LOOP_WIDEN_PASSES) {
+        Value unused;
+        int kept = 0;
+        for (int i = 0; i < head->count; i++) {
+            if (!tableGet(&loop->assigned, MAKE_OBJ_STRING(head->bindings[i].name), &unused)) {
+                head->bindings[kept++] = head->bindings[i];
+            }
+        }
+        head->count = kept;
+    }
+    copyTypeEnv(&parser->types, head);
+}
+
+// Loops are compiled assuming the types known at the loop head hold on every iteration.
+// Merges the types flowing back into the head, a pass that invalidated the assumption gets compiled again.
+static void mergeLoopTypes(Parser* parser, TypeEnv* head) {
+    if (parser->hadError || head->unreachable) return;
+    int known = head->count;
+    joinTypeEnv(head, &parser->types);
+    if (head->count != known) parser->loop_retry = true;
+}
+
+// Ends a pass over a loop. Returns true if the outermost loop must be compiled again, its code is then rewound.
+// That happens while a loop head's types change, then once more when the types settled in every loop,
+// with their invariant expressions hoisted.
+static bool repeatLoopPass(Parser* parser, LoopScope* loop, CompilePoint* loop_start, TypeEnv* head) {
+    LoopState* state = &parser->loop_states[loop->state];
+    copyTypeEnv(&state->head, head);
+    state->has_head = true;
+    if (!state->hoisted) {
+        for (int i = 0; i < parser->hoist_candidate_count; i++) {
+            if (parser->hoist_candidates[i].loop != loop) continue;
+            if (state->invariant_count >= state->invariant_capacity) {
+                int new_capacity = GROW_CAPACITY(state->invariant_capacity);
+                state->invariants = GROW_ARRAY(ExprNode*, state->invariants, state->invariant_capacity, new_capacity);
+                state->invariant_capacity = new_capacity;
+            }
+            state->invariants[state->invariant_count++] = parser->hoist_candidates[i].node;
+        }
+    }
+    if (parser->loop_driver != loop || parser->hadError) return false;
+    if (!parser->loop_retry) {
+        bool hoisting = false;
+        for (int i = loop->state; i < parser->loop_state_count; i++) {
+            if (parser->loop_states[i].hoisted) continue;
+            parser->loop_states[i].hoisted = true;
+            if (parser->loop_states[i].invariant_count > 0) hoisting = true;
+        }
+        if (!hoisting) return false;
+    }
+    if (parser->loop_retry) parser->failed_loop_passes++;
+    rewindTo(parser, loop_start);
+    copyTypeEnv(&parser->types, head);
+    return true;
+}
+
+static void whileStatement(Parser* parser) {
+    advance(parser);
+    LoopScope loop;
+    beginLoop(parser, &loop, true);
+    CompilePoint loop_start = markCompilePoint(parser);
+    TypeEnv head, exit;
+    initTypeEnv(&head);
+    initTypeEnv(&exit);
+    for (;;) {
+        beginLoopPass(parser, &loop, &head);
+        consume(parser, LEFT_PAREN_T, "Expect opening parenthesis.");
+        // Store condition evaluation address
+        int eval_address = currentChunk(parser)->current_index;
+        expression(parser);
+        consume(parser, RIGHT_PAREN_T, "Expect closing parenthesis.");
+        // Jump based on evaluated condition
+        int patch = emitForwardJump(parser, OP_JUMP_IF_FALSE_DISCARD);
+        copyTypeEnv(&exit, &parser->types);
+        // Statement body
+        statement(parser);
+        // Loopback
+        emitBackJump(parser, OP_JUMP, eval_address);
+        // Patch exit condition address
+        patchForwardJump(parser, patch);
+        mergeLoopTypes(parser, &head);
+        if (!repeatLoopPass(parser, &loop, &loop_start, &head)) break;
+    }
+    endLoop(parser, &loop);
+    copyTypeEnv(&parser->types, &exit);
+    freeTypeEnv(&head);
+    freeTypeEnv(&exit);
+}
+
+// Emits the operands of a range loop instruction, the counter, limit & step variables.
+static void emitRangeOperands(Parser* parser, Value range[3]) {
+    for (int i = 0; i < 3; i++) {
+        if (parser->function_depth > 0) {
+            emitConstantOperand(parser, range[i]);
+        } else {
+            emitByte(parser, globalSlot(parser, range[i]));
+        }
+    }
+}
+
+// Evaluates a range bound into its variable.
+static void emitRangeBound(Parser* parser, ExprNode* node, Value name) {
+    optimizeExpression(parser, node);
+    emitExpression(parser, node);
+    parser->expr_type = node->type;
+    emitSetVariable(parser, name, false);
+}
+
+// `for name in range([start,] limit[, step]) statement`, counts from start (0 by default) up to the limit excluded,
+// or down to it for a negative step (1 by default). The loop variable may be assigned in the body, counting goes on
+// from its new value. OP_FOR_RANGE steps, compares & jumps back to the body in one dispatch.
+static void rangeForStatement(Parser* parser) {
+    int depth = parser->loop == NULL ? 1 : parser->loop->depth + 1;
+    Value range[3];
+    range[0] = makeStrValue(parser->strings, parser->current.code, parser->current.length);
+    advance(parser);
+    consume(parser, IN_T, "Expect 'in' after loop variable.");
+    if (parser->current.type != IDENTIFIER_T || parser->current.length != 5 ||
+        memcmp(parser->current.code, "range", 5) != 0) {
+        errorAtCurrent(parser, "Expect 'range' after 'in'.");
+    }
+    advance(parser);
+    consume(parser, LEFT_PAREN_T, "Expect opening parenthesis.");
+    ExprNode* bounds[3];
+    int count = 0;
+    while (parser->current.type != RIGHT_PAREN_T && parser->current.type != EOF_T) {
+        ExprNode* bound = parseExpression(parser);
+        if (count < 3) bounds[count] = bound;
+        count++;
+        if (parser->current.type != RIGHT_PAREN_T) {
+            consume(parser, COMMA_T, "Expect comma.");
+        }
+    }
+    if (count < 1 || count > 3) {
+        errorAtCurrent(parser, "Incorrect number of operands for range.");
+        count = 0;
+    }
+    consume(parser, RIGHT_PAREN_T, "Expect closing parentheses.");
+
+    char name[32];
+    int length = snprintf(name, sizeof(name), RANGE_LIMIT_PREFIX "%d", depth);
+    range[1] = makeStrValue(parser->strings, name, length);
+    length = snprintf(name, sizeof(name), RANGE_STEP_PREFIX "%d", depth);
+    range[2] = makeStrValue(parser->strings, name, length);
+    // The start is evaluated last, so every bound still sees the loop variable's old value
+    ExprNode* start = count > 1 ? bounds[0] : constantNode(parser, MAKE_INTEGER(0));
+    ExprNode* limit = count > 1 ? bounds[1] : count == 1 ? bounds[0] : constantNode(parser, MAKE_INTEGER(0));
+    ExprNode* step = count > 2 ? bounds[2] : constantNode(parser, MAKE_INTEGER(1));
+    emitRangeBound(parser, limit, range[1]);
+    emitRangeBound(parser, step, range[2]);
+    emitRangeBound(parser, start, range[0]);
+    // Entering the loop & stepping it both check the variable holds a number
+    bindType(&parser->types, range[0].content.string_object, TYPE_NUMBER);
+
+    OpCode enter = parser->function_depth > 0 ? OP_FOR_RANGE_ENTER_VAR : OP_FOR_RANGE_ENTER;
+    OpCode step_op = parser->function_depth > 0 ? OP_FOR_RANGE_VAR : OP_FOR_RANGE;
+    LoopScope loop;
+    beginLoop(parser, &loop, false);
+    tableSet(&loop.assigned, range[0], MAKE_BOOL(true));
+    CompilePoint loop_start = markCompilePoint(parser);
+    TypeEnv head, exit;
+    initTypeEnv(&head);
+    initTypeEnv(&exit);
+    for (;;) {
+        beginLoopPass(parser, &loop, &head);
+        emitOp(parser, enter);
+        emitRangeOperands(parser, range);
+        int exit_patch = currentChunk(parser)->current_index;
+        emitBytes(parser, 0xff, 0xff);
+        copyTypeEnv(&exit, &parser->types);
+        int body_addr = currentChunk(parser)->current_index;
+        statement(parser);
+        emitOp(parser, step_op);
+        emitRangeOperands(parser, range);
+        emitBytes(parser, (body_addr >> 8) & 0xff, body_addr & 0xff);
+        patchForwardJump(parser, exit_patch);
+        mergeLoopTypes(parser, &head);
+        if (!repeatLoopPass(parser, &loop, &loop_start, &head)) break;
+    }
+    endLoop(parser, &loop);
+    copyTypeEnv(&parser->types, &exit);
+    freeTypeEnv(&head);
+    freeTypeEnv(&exit);
+}
+
+static void forStatement(Parser* parser) {
+    advance(parser);
+    if (parser->current.type == IDENTIFIER_T) {
+        rangeForStatement(parser);
+        return;
+    }
+    LoopScope loop;
+    beginLoop(parser, &loop, true);
+    CompilePoint loop_start = markCompilePoint(parser);
+    TypeEnv head, exit;
+    initTypeEnv(&head);
+    initTypeEnv(&exit);
+    for (;;) {
+        beginLoopPass(parser, &loop, &head);
+        consume(parser, LEFT_PAREN_T, "Expect opening parenthesis.");
+        int condition_addr = currentChunk(parser)->current_index;
+        // Condition
+        expression(parser);
+        consume(parser, SEMICOLON_T, "Expect ';'.");
+        int exit_patch = emitForwardJump(parser, OP_JUMP_IF_FALSE_DISCARD);
+        int body_patch = emitForwardJump(parser, OP_JUMP);
+        copyTypeEnv(&exit, &parser->types);
+        // Increment operation, runs after the body so it's compiled under the loop head's types
+        copyTypeEnv(&parser->types, &head);
+        int increment_addr = currentChunk(parser)->current_index;
+        statement(parser);
+        emitBackJump(parser, OP_JUMP, condition_addr);
+        consume(parser, RIGHT_PAREN_T, "Expect closing parenthesis.");
+        mergeLoopTypes(parser, &head);
+        // Body statement
+        copyTypeEnv(&parser->types, &exit);
+        patchForwardJump(parser, body_patch);
+        statement(parser);
+        // Evaluate back jump.
+        emitBackJump(parser, OP_JUMP, increment_addr);
+        patchForwardJump(parser, exit_patch);
+        mergeLoopTypes(parser, &head);
+        if (!repeatLoopPass(parser, &loop, &loop_start, &head)) break;
+    }
+    endLoop(parser, &loop);
+    copyTypeEnv(&parser->types, &exit);
+    freeTypeEnv(&head);
+    freeTypeEnv(&exit);
+}
+
+// A body of a single non recursive `return <expression>;` within the size budget gets inlined.
+static bool isInlinable(Parser* parser, InlineBody* inline_body) {
+    if (parser->calls_self || parser->memo_slot >= 0 || inline_body->body.current.type != RETURN_T) return false;
+    if (currentChunk(parser)->current_index - inline_body->body.code_index > INLINE_BUDGET) return false;
+    // `return;` has no expression to inline
+    Tokenizer lookahead = inline_body->body.tokenizer;
+    return nextToken(&lookahead).type != SEMICOLON_T;
+}
+
+static void addInlineBody(Parser* parser, Value functionName, InlineBody* inline_body) {
+    if (parser->inline_body_count >= parser->inline_body_capacity) {
+        int new_capacity = GROW_CAPACITY(parser->inline_body_capacity);
+        parser->inline_bodies = GROW_ARRAY(InlineBody, parser->inline_bodies, parser->inline_body_capacity, new_capacity);
+        parser->inline_body_capacity = new_capacity;
+    }
+    parser->inline_bodies[parser->inline_body_count] = *inline_body;
+    tableSet(&parser->inline_functions, functionName, MAKE_NUMBER(parser->inline_body_count));
+    parser->inline_body_count++;
+}
+
+static void defineStatement(Parser* parser, bool memo) {
+    if (parser->operand_stack_index != 0) {
+        errorAtCurrent(parser, "Internal failure, operand stack not empty.");
+    }
+    advance(parser);
+    if (parser->current.type != IDENTIFIER_T) {
+        errorAtCurrent(parser, "Require function identifier.");
     }
     // Emit jump
-    int end_function = emitForwardJump(OP_JUMP);
+    int end_function = emitForwardJump(parser, OP_JUMP);
     // Add function to function table
-    advance();
-    Value functionName = makeStrValue(copyString(parser.previous.code, parser.previous.length), parser.previous.length);
-    Value functionAddr = MAKE_NUMBER(currentChunk()->current_index);
-    if (!tableSet(&parser.function_addrs, functionName, functionAddr)) {
-        errorAtCurrent("Name has already been defined as function.");
+    advance(parser);
+    Value functionName = makeStrValue(parser->strings, parser->previous.code, parser->previous.length);
+    Value functionAddr = MAKE_NUMBER(currentChunk(parser)->current_index);
+    // A loop compiled again for type inference defines its functions again, at the same address
+    Value definedAddr;
+    if (tableGet(&parser->function_addrs, functionName, &definedAddr) &&
+        definedAddr.content.number_value != functionAddr.content.number_value) {
+        errorAtCurrent(parser, "Name has already been defined as function.");
     }
+    tableSet(&parser->function_addrs, functionName, functionAddr);
+    patchForwardCalls(parser, functionName, (int) functionAddr.content.number_value);
+    tableDelete(&parser->function_returns, functionName);
+    tableDelete(&parser->global_writers, functionName);
+    tableDelete(&parser->inline_functions, functionName);
+    tableDelete(&parser->pure_functions, functionName);
     // Parse operands
-    consume(LEFT_PAREN_T, "Expect opening parenthesis.");
-    while (parser.current.type != RIGHT_PAREN_T) {
-        if (parser.current.type != IDENTIFIER_T) {
-            errorAtCurrent("Expect identifiers.");
+    consume(parser, LEFT_PAREN_T, "Expect opening parenthesis.");
+    while (parser->current.type != RIGHT_PAREN_T) {
+        if (parser->current.type != IDENTIFIER_T) {
+            errorAtCurrent(parser, "Expect identifiers.");
         }
-        advance();
-        Value operandName = makeStrValue(copyString(parser.previous.code, parser.previous.length), parser.previous.length);
-        stackPush(operandName);
-        if (parser.current.type != RIGHT_PAREN_T) {
-            consume(COMMA_T, "Expect comma.");
+        advance(parser);
+        Value operandName = makeStrValue(parser->strings, parser->previous.code, parser->previous.length);
+        stackPush(parser, operandName);
+        if (parser->current.type != RIGHT_PAREN_T) {
+            consume(parser, COMMA_T, "Expect comma.");
         }
     }
-    consume(RIGHT_PAREN_T, "");
-    // Up Scope
-    emitByte(OP_UP_SCOPE);
+    consume(parser, RIGHT_PAREN_T, "");
+    // Up Scope, its operand is the frame size patched in once the body is compiled
+    emitOp(parser, OP_UP_SCOPE);
+    int frame_size_patch = emitFramePlaceholder(parser);
+    // The function body gets a frame of its own, starting with the operands
+    int outer_depth = parser->stack_depth;
+    int outer_max_depth = parser->max_stack_depth;
+    Table outer_locals = parser->frame_locals;
+    int outer_local_count = parser->frame_local_count;
+    TypeEnv outer_types = parser->types;
+    StaticType outer_return_type = parser->return_type;
+    bool outer_writes_globals = parser->writes_globals;
+    Value outer_function_name = parser->function_name;
+    bool outer_calls_self = parser->calls_self;
+    bool outer_impure = parser->impure;
+    int outer_memo_slot = parser->memo_slot;
+    // Loops around the definition belong to another frame
+    LoopScope* outer_loop = parser->loop;
+    int first_get_var_site = parser->get_var_sites.current_index;
+    initTable(&parser->frame_locals);
+    // Nothing is known about the operands
+    initTypeEnv(&parser->types);
+    parser->return_type = TYPE_NEVER;
+    parser->writes_globals = false;
+    parser->function_name = functionName;
+    parser->calls_self = false;
+    parser->impure = false;
+    parser->memo_slot = memo ? memoSlot(parser, functionName) : -1;
+    parser->loop = NULL;
     // Collect operands & assign to identifiers.
-    int operand_count = parser.operand_stack_index;
+    int operand_count = parser->operand_stack_index;
+    InlineBody inline_body;
+    inline_body.operand_count = operand_count;
+    parser->frame_local_count = operand_count;
+    parser->stack_depth = 0;
+    parser->max_stack_depth = 0;
     // Record number of operands required.
-    tableSet(&parser.function_operands, functionName, MAKE_NUMBER(operand_count));
+    tableSet(&parser->function_operands, functionName, MAKE_NUMBER(operand_count));
     for (int i=0; i<operand_count; i++) {
-        emitByte(OP_ASSIGN_LOCAL);
-        emitByte(i + 1);
-        chunkAddConstant(currentChunk(), stackPop());
+        Value operandName = stackPop(parser);
+        inline_body.operands[operand_count - 1 - i] = operandName.content.string_object;
+        tableSet(&parser->frame_locals, operandName, MAKE_NONE);
+        emitOp(parser, OP_ASSIGN_LOCAL);
+        emitByte(parser, i + 1);
+        emitConstantOperand(parser, operandName);
+    }
+    if (memo) {
+        // Operands already in the memo table return right away, otherwise their key becomes a local
+        emitOp(parser, OP_MEMO_LOOKUP);
+        emitBytes(parser, parser->memo_slot, operand_count);
+        emitConstantOperand(parser, makeStrValue(parser->strings, MEMO_KEY_NAME, sizeof(MEMO_KEY_NAME) - 1));
+        parser->frame_local_count++;
     }
-    consume(LEFT_BRACE_T, "Expect opening brace.");
-    while (parser.current.type != RIGHT_BRACE_T) {
+    consume(parser, LEFT_BRACE_T, "Expect opening brace.");
+    inline_body.body = markCompilePoint(parser);
+    int statement_count = 0;
+    parser->function_depth++;
+    while (parser->current.type != RIGHT_BRACE_T) {
         // Parse statement body
-        statement();
+        statement(parser);
+        statement_count++;
     }
-    consume(RIGHT_BRACE_T, "Expect closing brace.");
+    parser->function_depth--;
+    if (statement_count == 1 && isInlinable(parser, &inline_body)) {
+        addInlineBody(parser, functionName, &inline_body);
+    }
+    consume(parser, RIGHT_BRACE_T, "Expect closing brace.");
     // Default return statement
-    emitConstant(MAKE_NONE);
-    emitByte(OP_RETURN);
+    if (!parser->types.unreachable) parser->return_type = joinTypes(parser->return_type, TYPE_NONE);
+    emitConstant(parser, MAKE_NONE);
+    emitMemoStore(parser);
+    emitOp(parser, OP_RETURN);
+    StaticType return_type = parser->return_type == TYPE_NEVER ? TYPE_UNKNOWN : parser->return_type;
+    tableSet(&parser->function_returns, functionName, MAKE_NUMBER(return_type));
+    if (parser->writes_globals) tableSet(&parser->global_writers, functionName, MAKE_BOOL(true));
+    if (resolveGlobalReads(parser, first_get_var_site)) parser->impure = true;
+    if (!parser->impure && !parser->writes_globals) {
+        tableSet(&parser->pure_functions, functionName, MAKE_BOOL(true));
+    } else if (memo) {
+        error(parser, "A @memo function must be pure, it can't print, call time() or use globals.");
+    }
+    freeTypeEnv(&parser->types);
+    parser->types = outer_types;
+    parser->return_type = outer_return_type;
+    parser->writes_globals = outer_writes_globals;
+    parser->function_name = outer_function_name;
+    parser->calls_self = outer_calls_self;
+    parser->impure = outer_impure;
+    parser->memo_slot = outer_memo_slot;
+    parser->loop = outer_loop;
+    // Locals sit below the temporaries
+    patchFrameSize(parser, frame_size_patch, parser->frame_local_count + parser->max_stack_depth);
+    freeTable(&parser->frame_locals);
+    parser->frame_locals = outer_locals;
+    parser->frame_local_count = outer_local_count;
+    parser->stack_depth = outer_depth;
+    parser->max_stack_depth = outer_max_depth;
     // Patch jump
-    patchForwardJump(end_function);
+    patchForwardJump(parser, end_function);
+}
+
+// Parses the callee's return expression in place of the call, its operands are read straight off the stack.
+static void inlineBody(Parser* parser, ExprNode* call, InlineBody* callee, StaticType* operand_types) {
+    InlineFrame frame;
+    frame.callee = callee;
+    frame.call = call;
+    for (int i = 0; i < callee->operand_count; i++) {
+        frame.operand_types[i] = operand_types[i];
+    }
+    InlineFrame* outer_frame = parser->inline_frame;
+    CompilePoint call_site = markCompilePoint(parser);
+    parser->inline_frame = &frame;
+    parser->inline_depth++;
+    restoreTokens(parser, &callee->body);
+    // Skip the return keyword
+    advance(parser);
+    call->left = parseExpression(parser);
+    parser->inline_depth--;
+    parser->inline_frame = outer_frame;
+    restoreTokens(parser, &call_site);
+    call->kind = EXPR_INLINE_CALL;
+    call->type = call->left->type;
 }
 
-static void functionCall() {
-    Value functionName = makeStrValue(copyString(parser.previous.code, parser.previous.length), parser.previous.length);
-    consume(LEFT_PAREN_T, "Expect opening parenthesis.");
+// Parses a call to the function named by the previous token, small functions get their body inlined.
+static ExprNode* callExpression(Parser* parser) {
+    Value functionName = makeStrValue(parser->strings, parser->previous.code, parser->previous.length);
+    ExprNode* call = newNode(parser, EXPR_CALL);
+    call->value = functionName;
+    consume(parser, LEFT_PAREN_T, "Expect opening parenthesis.");
     // Collect required number of operands
     Value operands_required;
-    if (!tableGet(&parser.function_operands, functionName, &operands_required)){
-        errorAtCurrent("Internal error, cannot find required number of operands for function call.");
+    if (!tableGet(&parser->function_operands, functionName, &operands_required)){
+        errorAtCurrent(parser, "Internal error, cannot find required number of operands for function call.");
     }
-    int num_operands_given = 0;
+    StaticType operand_types[OPERAND_STACK_LIMIT];
+    ExprNode** operand = &call->args;
     // Parse operands
-    while (parser.current.type != RIGHT_PAREN_T) {
-        expression();
+    while (parser->current.type != RIGHT_PAREN_T) {
+        *operand = parseExpression(parser);
+        if (call->arg_count < OPERAND_STACK_LIMIT) operand_types[call->arg_count] = (*operand)->type;
+        operand = &(*operand)->next;
         // Expect comma
-        if (parser.current.type != RIGHT_PAREN_T) {
-            consume(COMMA_T, "Expect comma.");
+        if (parser->current.type != RIGHT_PAREN_T) {
+            consume(parser, COMMA_T, "Expect comma.");
         }
-        num_operands_given++;
+        call->arg_count++;
     }
-    if (num_operands_given != operands_required.content.number_value){
-        errorAtCurrent("Incorrect number of operands for function call.");
+    if (call->arg_count != operands_required.content.number_value){
+        errorAtCurrent(parser, "Incorrect number of operands for function call.");
     }
-    consume(RIGHT_PAREN_T, "");
-    emitByte(OP_RA_PUSH);
-    chunkAddConstant(currentChunk(), MAKE_NUMBER(currentChunk()->current_index+4));
-    Value functionAddr;
-    tableGet(&parser.function_addrs, functionName, &functionAddr);
-    emitBackJump(OP_JUMP, functionAddr.content.number_value);
+    consume(parser, RIGHT_PAREN_T, "");
+    bool recursive = parser->function_name.type == OBJECT_STRING_TYPE &&
+            parser->function_name.content.string_object == functionName.content.string_object;
+    if (recursive) parser->calls_self = true;
+    Value pure;
+    if (!recursive && !tableGet(&parser->pure_functions, functionName, &pure)) parser->impure = true;
+    Value inline_index;
+    if (parser->inlining && parser->inline_depth < INLINE_DEPTH_LIMIT && !parser->hadError &&
+        tableGet(&parser->inline_functions, functionName, &inline_index)) {
+        inlineBody(parser, call, &parser->inline_bodies[(int) inline_index.content.number_value], operand_types);
+        return call;
+    }
+    // Globals the callee may assign no longer have a known type.
+    // An enclosing function still being compiled may assign any, recursion into the current one adds nothing.
+    Value writer;
+    bool compiled = tableGet(&parser->function_returns, functionName, &writer);
+    if (tableGet(&parser->global_writers, functionName, &writer) || (!compiled && !recursive)) {
+        if (parser->function_depth > 0) {
+            parser->writes_globals = true;
+        } else {
+            parser->types.count = 0;
+        }
+    }
+    // A function still being compiled has no result type yet
+    Value return_type;
+    call->type = tableGet(&parser->function_returns, functionName, &return_type) ?
+            (StaticType) return_type.content.number_value : TYPE_UNKNOWN;
+    return call;
+}
+
+// Compiles `return f(...);` in a function into a tail call, the callee takes over the current frame
+// & returns straight to the caller's caller.
+static void tailCall(Parser* parser, ExprNode* call) {
+    emitArguments(parser, call);
+    emitOp(parser, OP_TAIL_CALL);
+    emitByte(parser, call->arg_count);
+    emitFunctionAddress(parser, call->value);
+    adjustStackDepth(parser, -call->arg_count);
+    // Recursing into the current function returns whatever its other returns do
+    bool recursive = parser->function_name.content.string_object == call->value.content.string_object;
+    StaticType call_type = recursive ? TYPE_NEVER : call->type;
+    if (!parser->types.unreachable) parser->return_type = joinTypes(parser->return_type, call_type);
+    parser->types.unreachable = true;
 }
 
-static void returnStatement() {
-    advance();
-    if (parser.current.type == SEMICOLON_T) { // Return None
-        emitConstant(MAKE_NONE);
+static void returnStatement(Parser* parser) {
+    advance(parser);
+    ExprNode* node = NULL;
+    if (parser->current.type != SEMICOLON_T) {
+        node = parseExpression(parser);
+        optimizeExpression(parser, node);
+    }
+    consume(parser, SEMICOLON_T, "Expect end of statement.");
+    // A memoized function has to see its result before returning it, an inlined call has no frame to hand over
+    if (node != NULL && node->kind == EXPR_CALL && parser->function_depth > 0 && parser->memo_slot < 0) {
+        tailCall(parser, node);
+        return;
+    }
+    if (node == NULL) { // Return None
+        emitConstant(parser, MAKE_NONE);
+        parser->expr_type = TYPE_NONE;
     } else {
-        expression();
+        emitExpression(parser, node);
+        parser->expr_type = node->type;
     }
-    consume(SEMICOLON_T, "Expect end of statement.");
-    emitByte(OP_RETURN);
+    emitMemoStore(parser);
+    emitOp(parser, OP_RETURN);
+    if (!parser->types.unreachable) parser->return_type = joinTypes(parser->return_type, parser->expr_type);
+    parser->types.unreachable = true;
 }
 
-static void statement() {
-    TokenType curr_statement = parser.current.type;
+static void statement(Parser* parser) {
+    TokenType curr_statement = parser->current.type;
     if (curr_statement == IDENTIFIER_T) {
-        Value functionName = makeStrValue(copyString(parser.current.code, parser.current.length), parser.current.length);
+        Value functionName = makeStrValue(parser->strings, parser->current.code, parser->current.length);
         Value temp;
-        if (tableGet(&parser.function_addrs, functionName, &temp)){
-            advance();
-            functionCall();
-            consume(SEMICOLON_T, "Expect end of statement.");
+        if (tableGet(&parser->function_operands, functionName, &temp)){
+            advance(parser);
+            ExprNode* call = callExpression(parser);
+            call->last = parser->previous;
+            consume(parser, SEMICOLON_T, "Expect end of statement.");
+            optimizeExpression(parser, call);
+            if (call->kind == EXPR_INLINE_CALL) {
+                // An inlined call leaves its result on the stack
+                emitExpression(parser, call);
+                emitOp(parser, OP_POP);
+            } else {
+                emitCall(parser, call);
+            }
+            return;
+        }
+        if (peekToken(parser).type == LEFT_PAREN_T && tableGet(&parser->runtime->native_names, functionName, &temp)) {
+            advance(parser);
+            ExprNode* call = nativeCall(parser, functionName, (int) temp.content.number_value);
+            call->last = parser->previous;
+            consume(parser, SEMICOLON_T, "Expect end of statement.");
+            optimizeExpression(parser, call);
+            emitExpression(parser, call);
+            emitOp(parser, OP_POP);
             return;
         }
     }
     switch (curr_statement) {
         case PRINT_T:
-            printStatement(); break;
+            printStatement(parser); break;
         case PRINTLN_T:
-            printlnStatement(); break;
+            printlnStatement(parser); break;
         case IDENTIFIER_T:
-            assignIdentidier(false); break;
+            assignIdentidier(parser, false); break;
         case GLOBAL_T:
-            advance();
-            assignIdentidier(true); break;
+            advance(parser);
+            assignIdentidier(parser, true); break;
         case LEFT_BRACE_T:
-            group(); break;
+            group(parser); break;
         case IF_T:
-            ifStatement(); break;
+            ifStatement(parser); break;
         case WHILE_T:
-            whileStatement(); break;
+            whileStatement(parser); break;
         case FOR_T:
-            forStatement(); break;
+            forStatement(parser); break;
         case DEF_T:
-            defineStatement(); break;
+            defineStatement(parser, false); break;
+        case MEMO_T:
+            advance(parser);
+            if (parser->current.type != DEF_T) {
+                errorAtCurrent(parser, "Expect function definition after '@memo'.");
+                break;
+            }
+            defineStatement(parser, true); break;
         case RETURN_T:
-            returnStatement(); break;
+            returnStatement(parser); break;
+        case DEL_T:
+            deleteStatement(parser); break;
         default:
-            errorAtCurrent("Invalid statement type."); break;
+            errorAtCurrent(parser, "Invalid statement type."); break;
     }
 }
 
-bool compile(const char *source, Chunk *chunk) {
-    initTokenizer(&tokenizer, source);
+// Sizes the intern table up front so compiling large sources doesn't keep rehashing it.
+static void reserveInternedNames(Parser* parser, const char *source) {
+    Tokenizer counter;
+    initTokenizer(&counter, source);
+    int names = 0;
+    for (;;) {
+        Token token = nextToken(&counter);
+        if (token.type == EOF_T) break;
+        if (token.type == IDENTIFIER_T || token.type == STRING_T) names++;
+    }
+    reserveStrTable(parser->strings, internedStringCount(parser->strings) + names);
+}
 
-    compilingChunk = chunk;
+// Declares every function up front with its number of operands,
+// so a function may be called above its definition, e.g. by mutually recursive functions.
+static void declareFunctions(Parser* parser, const char *source) {
+    Tokenizer scanner;
+    initTokenizer(&scanner, source);
+    Token token = nextToken(&scanner);
+    while (token.type != EOF_T) {
+        if (token.type != DEF_T) {
+            token = nextToken(&scanner);
+            continue;
+        }
+        Token name = nextToken(&scanner);
+        token = nextToken(&scanner);
+        if (name.type != IDENTIFIER_T || token.type != LEFT_PAREN_T) continue;
+        int operand_count = 0;
+        token = nextToken(&scanner);
+        while (token.type == IDENTIFIER_T || token.type == COMMA_T) {
+            if (token.type == IDENTIFIER_T) operand_count++;
+            token = nextToken(&scanner);
+        }
+        tableSet(&parser->function_operands, makeStrValue(parser->strings, name.code, name.length), MAKE_NUMBER(operand_count));
+    }
+}
 
-    initParser();
+void initCompileOptions(CompileOptions* options) {
+    options->inline_functions = true;
+    options->hoist_invariants = true;
+    options->dump_ir = false;
+}
 
-    advance();
-    while (parser.current.type != EOF_T) {
-        statement();
+bool compile(Runtime* runtime, const char *source, Chunk *chunk, CompileOptions* options) {
+    Parser state;
+    Parser* parser = &state;
+    initParser(parser);
+    parser->runtime = runtime;
+    parser->strings = &runtime->strings;
+    reserveInternedNames(parser, source);
+    initTokenizer(&parser->tokenizer, source);
+
+    parser->chunk = chunk;
+
+    parser->inlining = options->inline_functions;
+    parser->hoisting = options->hoist_invariants;
+    parser->dump_ir = options->dump_ir;
+    parser->source = source;
+    declareFunctions(parser, source);
+
+    advance(parser);
+    while (parser->current.type != EOF_T) {
+        statement(parser);
+        resetArena(&parser->ir);
+    }
+    consume(parser, EOF_T, "Expect end of expression.");
+    if (parser->forward_call_count > 0) {
+        errorAtCurrent(parser, "Function called but never defined.");
     }
-    consume(EOF_T, "Expect end of expression.");
-    endCompiler();
-    return !parser.hadError;
+    endCompiler(parser);
+    freeTypeEnv(&parser->types);
+    resetValueArray(&parser->get_var_sites);
+    freeTable(&parser->inline_functions);
+    FREE_ARRAY(InlineBody, parser->inline_bodies, parser->inline_body_capacity);
+    FREE_ARRAY(ForwardCall, parser->forward_calls, parser->forward_call_capacity);
+    FREE_ARRAY(LoopState, parser->loop_states, parser->loop_state_capacity);
+    FREE_ARRAY(HoistCandidate, parser->hoist_candidates, parser->hoist_candidate_capacity);
+    FREE_ARRAY(HoistedExpression, parser->hoisted, parser->hoisted_capacity);
+    freeArena(&parser->ir);
+    freeTable(&parser->function_returns);
+    freeTable(&parser->global_writers);
+    freeTable(&parser->pure_functions);
+    freeTable(&parser->memo_slots);
+    freeTable(&parser->function_addrs);
+    freeTable(&parser->function_operands);
+    freeTable(&parser->global_slots);
+    freeTable(&parser->frame_locals);
+    // Verified once here, the VMs running the chunk only read it from now on
+    if (!parser->hadError && !verifyChunk(chunk, runtime)) parser->hadError = true;
+    return !parser->hadError;
 }
@@ -7,6 +7,18 @@
 
 #include "vm.h"
 
-bool compile(const char* source, Chunk* chunk);
+typedef struct {
+    // Inline small functions at their call sites
+    bool inline_functions;
+    // Compute expressions that don't change in a loop once before it
+    bool hoist_invariants;
+    // Print the tree of each expression before it gets compiled to bytecode
+    bool dump_ir;
+} CompileOptions;
+
+void initCompileOptions(CompileOptions* options);
+// Compiles source into chunk, its strings are interned in the runtime.
+// Each call keeps its own compiler state, several sources may be compiled at the same time.
+bool compile(Runtime* runtime, const char* source, Chunk* chunk, CompileOptions* options);
 
 #endif //CJLANG_COMPILER_H
@@ -3,6 +3,7 @@
 //
 
 #include "debugTools.h"
+#include "makeString.h"
 
 static int singleOperandInstruction(Chunk* chunk, int index) {
     if (index + 1 >= chunk->current_index){
@@ -15,17 +16,49 @@ static int singleOperandInstruction(Chunk* chunk, int index) {
     return index + 1;
 }
 
-static int raPushInstruction(Chunk* chunk, int index) {
+static int globalInstruction(Chunk* chunk, int index) {
     if (index + 1 >= chunk->current_index){
         printf("Chunk end reached, missing operand.");
         return index;
     }
-    int ra = chunk->constant_array.values[chunk->bytecode_array[index + 1]].content.number_value;
-    printf("  ^Operand| Chunk Index:");
+    uint8_t slot = chunk->bytecode_array[index + 1];
+    printf("  ^Operand| Global: ");
+    printValue(chunk->global_names.values[slot]);
+    printf(" @<%d>\n", slot);
+    return index + 1;
+}
+
+static int getVarInstruction(Chunk* chunk, int index) {
+    if (index + 2 >= chunk->current_index){
+        printf("Chunk end reached, missing operand.");
+        return index;
+    }
+    index = singleOperandInstruction(chunk, index);
+    printf("  ^Operand| Fallback global slot: <%d>\n", chunk->bytecode_array[index + 1]);
+    return index + 1;
+}
+
+static int stackOperandInstruction(Chunk* chunk, int index) {
+    if (index + 1 >= chunk->current_index){
+        printf("Chunk end reached, missing operand.");
+        return index;
+    }
+    printf("  ^Operand| Stack[-%d]\n", chunk->bytecode_array[index + 1]);
+    return index + 1;
+}
+
+// The return address isn't an operand, it's the instruction after the call's jump.
+static int raPushInstruction(Chunk* chunk, int index) {
+    int ra = index + 1 + instructionLength(OP_JUMP);
+    if (ra >= chunk->current_index){
+        printf("Chunk end reached, missing return address.");
+        return index;
+    }
+    printf("  ^Return| Chunk Index:");
     printf("[%d]", ra);
     printf(" -> ");
     printOp(chunk->bytecode_array[ra]);
-    return index + 1;
+    return index;
 }
 
 static int jumpInstruction(Chunk* chunk, int index) {
@@ -41,6 +74,36 @@ static int jumpInstruction(Chunk* chunk, int index) {
     return index + 2;
 }
 
+static int rangeInstruction(Chunk* chunk, int index, bool locals) {
+    if (index + 5 >= chunk->current_index){
+        printf("Chunk end reached, missing operand.");
+        return index;
+    }
+    for (int i = 0; i < 3; i++) {
+        index = locals ? singleOperandInstruction(chunk, index) : globalInstruction(chunk, index);
+    }
+    return jumpInstruction(chunk, index);
+}
+
+static int tailCallInstruction(Chunk* chunk, int index) {
+    if (index + 3 >= chunk->current_index){
+        printf("Chunk end reached, missing operand.");
+        return index;
+    }
+    printf("  ^Operand| Operand count: %d\n", chunk->bytecode_array[index + 1]);
+    return jumpInstruction(chunk, index + 1);
+}
+
+static int frameSizeInstruction(Chunk* chunk, int index) {
+    if (index + 2 >= chunk->current_index){
+        printf("Chunk end reached, missing operand.");
+        return index;
+    }
+    uint16_t frame_size = (uint16_t)((chunk->bytecode_array[index + 1] << 8) | chunk->bytecode_array[index + 2]);
+    printf("  ^Operand| Frame size: %d\n", frame_size);
+    return index + 2;
+}
+
 static int assignLocalInstruction(Chunk* chunk, int index) {
     if (index + 1 >= chunk->current_index){
         printf("Chunk end reached, missing operand.");
@@ -73,12 +136,45 @@ void printChunk(Chunk* chunk){
             case OP_TRUE: printf("OP_TRUE\n"); break;
             case OP_FALSE: printf("OP_FALSE\n"); break;
             case OP_POP: printf("OP_POP\n"); break;
-            case OP_GET_TYPE: printf("OP_GET_TYPE\n"); break;
-            case OP_GET_LEN: printf("OP_GET_LEN\n"); break;
-            case OP_GET_TIME: printf("OP_GET_TIME\n"); break;
+            case OP_PEEK: {
+                printf("OP_PEEK\n");
+                i = stackOperandInstruction(chunk, i);
+                break;
+            }
+            case OP_SQUASH: {
+                printf("OP_SQUASH\n");
+                i = stackOperandInstruction(chunk, i);
+                break;
+            }
+            case OP_BUILD_LIST: {
+                printf("OP_BUILD_LIST\n");
+                printf("  ^Operand| Item count: %d\n", chunk->bytecode_array[i + 1]);
+                i++;
+                break;
+            }
+            case OP_GET_INDEX: printf("OP_GET_INDEX\n"); break;
+            case OP_SET_INDEX: printf("OP_SET_INDEX\n"); break;
+            case OP_BUILD_MAP: {
+                printf("OP_BUILD_MAP\n");
+                printf("  ^Operand| Entry count: %d\n", chunk->bytecode_array[i + 1]);
+                i++;
+                break;
+            }
+            case OP_DELETE_KEY: printf("OP_DELETE_KEY\n"); break;
+            case OP_HAS_KEY: printf("OP_HAS_KEY\n"); break;
             case OP_GET_VAR: {
                 printf("OP_GET_VAR\n");
-                i = singleOperandInstruction(chunk, i);
+                i = getVarInstruction(chunk, i);
+                break;
+            }
+            case OP_GET_VAR_GLOBAL: {
+                printf("OP_GET_VAR_GLOBAL\n");
+                i = getVarInstruction(chunk, i);
+                break;
+            }
+            case OP_GET_GLOBAL: {
+                printf("OP_GET_GLOBAL\n");
+                i = globalInstruction(chunk, i);
                 break;
             }
             case OP_SET_VAR: {
@@ -93,10 +189,14 @@ void printChunk(Chunk* chunk){
             }
             case OP_SET_GLOBAL: {
                 printf("OP_SET_GLOBAL\n");
-                i = singleOperandInstruction(chunk, i);
+                i = globalInstruction(chunk, i);
+                break;
+            }
+            case OP_UP_SCOPE: {
+                printf("OP_UP_SCOPE\n");
+                i = frameSizeInstruction(chunk, i);
                 break;
             }
-            case OP_UP_SCOPE: printf("OP_UP_SCOPE\n"); break;
             case OP_DOWN_SCOPE: printf("OP_DOWN_SCOPE\n"); break;
             case OP_EQUAL: printf("OP_EQUAL\n"); break;
             case OP_GREATER: printf("OP_GREATER\n"); break;
@@ -107,6 +207,19 @@ void printChunk(Chunk* chunk){
             case OP_DIVIDE: printf("OP_DIVIDE\n"); break;
             case OP_EXPONENT: printf("OP_EXPONENT\n"); break;
             case OP_MOD: printf("OP_MOD\n"); break;
+            case OP_ADD_NUM: printf("OP_ADD_NUM\n"); break;
+            case OP_SUBTRACT_NUM: printf("OP_SUBTRACT_NUM\n"); break;
+            case OP_MULTIPLY_NUM: printf("OP_MULTIPLY_NUM\n"); break;
+            case OP_DIVIDE_NUM: printf("OP_DIVIDE_NUM\n"); break;
+            case OP_GREATER_NUM: printf("OP_GREATER_NUM\n"); break;
+            case OP_LESS_NUM: printf("OP_LESS_NUM\n"); break;
+            case OP_ADD_NUM_GUARDED: printf("OP_ADD_NUM_GUARDED\n"); break;
+            case OP_ADD_STR_GUARDED: printf("OP_ADD_STR_GUARDED\n"); break;
+            case OP_SUBTRACT_NUM_GUARDED: printf("OP_SUBTRACT_NUM_GUARDED\n"); break;
+            case OP_MULTIPLY_NUM_GUARDED: printf("OP_MULTIPLY_NUM_GUARDED\n"); break;
+            case OP_DIVIDE_NUM_GUARDED: printf("OP_DIVIDE_NUM_GUARDED\n"); break;
+            case OP_GREATER_NUM_GUARDED: printf("OP_GREATER_NUM_GUARDED\n"); break;
+            case OP_LESS_NUM_GUARDED: printf("OP_LESS_NUM_GUARDED\n"); break;
             case OP_NOT: printf("OP_NOT\n"); break;
             case OP_NEGATE: printf("OP_NEGATE\n"); break;
             case OP_PRINT: printf("OP_PRINT\n"); break;
@@ -132,7 +245,51 @@ void printChunk(Chunk* chunk){
                 break;
             }
             case OP_LOOP: printf("OP_LOOP\n"); break;
+            case OP_FOR_RANGE_ENTER: {
+                printf("OP_FOR_RANGE_ENTER\n");
+                i = rangeInstruction(chunk, i, false);
+                break;
+            }
+            case OP_FOR_RANGE: {
+                printf("OP_FOR_RANGE\n");
+                i = rangeInstruction(chunk, i, false);
+                break;
+            }
+            case OP_FOR_RANGE_ENTER_VAR: {
+                printf("OP_FOR_RANGE_ENTER_VAR\n");
+                i = rangeInstruction(chunk, i, true);
+                break;
+            }
+            case OP_FOR_RANGE_VAR: {
+                printf("OP_FOR_RANGE_VAR\n");
+                i = rangeInstruction(chunk, i, true);
+                break;
+            }
             case OP_CALL: printf("OP_CALL\n"); break;
+            case OP_CALL_NATIVE: {
+                printf("OP_CALL_NATIVE\n");
+                printf("  ^Operand| Native: <%d>\n", chunk->bytecode_array[i + 1]);
+                i++;
+                break;
+            }
+            case OP_TAIL_CALL: {
+                printf("OP_TAIL_CALL\n");
+                i = tailCallInstruction(chunk, i);
+                break;
+            }
+            case OP_MEMO_LOOKUP: {
+                printf("OP_MEMO_LOOKUP\n");
+                printf("  ^Operand| Memo table: <%d>\n", chunk->bytecode_array[i + 1]);
+                printf("  ^Operand| Operand count: %d\n", chunk->bytecode_array[i + 2]);
+                i = singleOperandInstruction(chunk, i + 2);
+                break;
+            }
+            case OP_MEMO_STORE: {
+                printf("OP_MEMO_STORE\n");
+                printf("  ^Operand| Memo table: <%d>\n", chunk->bytecode_array[i + 1]);
+                i = singleOperandInstruction(chunk, i + 1);
+                break;
+            }
             case OP_RA_PUSH: {
                 printf("OP_RA_PUSH\n");
                 i = raPushInstruction(chunk, i);
@@ -155,10 +312,17 @@ void printOp(uint8_t opCode) {
         case OP_TRUE: printf("OP_TRUE]\n"); break;
         case OP_FALSE: printf("OP_FALSE]\n"); break;
         case OP_POP: printf("OP_POP]\n"); break;
-        case OP_GET_TYPE: printf("OP_GET_TYPE]\n"); break;
-        case OP_GET_LEN: printf("OP_GET_LEN]\n"); break;
-        case OP_GET_TIME: printf("OP_GET_TIME]\n"); break;
+        case OP_PEEK: printf("OP_PEEK]\n"); break;
+        case OP_SQUASH: printf("OP_SQUASH]\n"); break;
+        case OP_BUILD_LIST: printf("OP_BUILD_LIST]\n"); break;
+        case OP_GET_INDEX: printf("OP_GET_INDEX]\n"); break;
+        case OP_SET_INDEX: printf("OP_SET_INDEX]\n"); break;
+        case OP_BUILD_MAP: printf("OP_BUILD_MAP]\n"); break;
+        case OP_DELETE_KEY: printf("OP_DELETE_KEY]\n"); break;
+        case OP_HAS_KEY: printf("OP_HAS_KEY]\n"); break;
         case OP_GET_VAR: printf("OP_GET_VAR]\n"); break;
+        case OP_GET_VAR_GLOBAL: printf("OP_GET_VAR_GLOBAL]\n"); break;
+        case OP_GET_GLOBAL: printf("OP_GET_GLOBAL]\n"); break;
         case OP_SET_GLOBAL: printf("OP_SET_GLOBAL]\n"); break;
         case OP_SET_VAR: printf("OP_SET_VAR]\n"); break;
         case OP_ASSIGN_LOCAL: printf("OP_ASSIGN_LOCAL]\n"); break;
@@ -173,6 +337,19 @@ void printOp(uint8_t opCode) {
         case OP_DIVIDE: printf("OP_DIVIDE]\n"); break;
         case OP_EXPONENT: printf("OP_EXPONENT]\n"); break;
         case OP_MOD: printf("OP_MOD]\n"); break;
+        case OP_ADD_NUM: printf("OP_ADD_NUM]\n"); break;
+        case OP_SUBTRACT_NUM: printf("OP_SUBTRACT_NUM]\n"); break;
+        case OP_MULTIPLY_NUM: printf("OP_MULTIPLY_NUM]\n"); break;
+        case OP_DIVIDE_NUM: printf("OP_DIVIDE_NUM]\n"); break;
+        case OP_GREATER_NUM: printf("OP_GREATER_NUM]\n"); break;
+        case OP_LESS_NUM: printf("OP_LESS_NUM]\n"); break;
+        case OP_ADD_NUM_GUARDED: printf("OP_ADD_NUM_GUARDED]\n"); break;
+        case OP_ADD_STR_GUARDED: printf("OP_ADD_STR_GUARDED]\n"); break;
+        case OP_SUBTRACT_NUM_GUARDED: printf("OP_SUBTRACT_NUM_GUARDED]\n"); break;
+        case OP_MULTIPLY_NUM_GUARDED: printf("OP_MULTIPLY_NUM_GUARDED]\n"); break;
+        case OP_DIVIDE_NUM_GUARDED: printf("OP_DIVIDE_NUM_GUARDED]\n"); break;
+        case OP_GREATER_NUM_GUARDED: printf("OP_GREATER_NUM_GUARDED]\n"); break;
+        case OP_LESS_NUM_GUARDED: printf("OP_LESS_NUM_GUARDED]\n"); break;
         case OP_NOT: printf("OP_NOT]\n"); break;
         case OP_NEGATE: printf("OP_NEGATE]\n"); break;
         case OP_PRINT: printf("OP_PRINT]\n"); break;
@@ -182,7 +359,15 @@ void printOp(uint8_t opCode) {
         case OP_JUMP_IF_FALSE_DISCARD: printf("OP_JUMP_IF_FALSE_DISCARD]\n"); break;
         case OP_JUMP_IF_TRUE: printf("OP_JUMP_IF_TRUE]\n"); break;
         case OP_LOOP: printf("OP_LOOP]\n"); break;
+        case OP_FOR_RANGE_ENTER: printf("OP_FOR_RANGE_ENTER]\n"); break;
+        case OP_FOR_RANGE: printf("OP_FOR_RANGE]\n"); break;
+        case OP_FOR_RANGE_ENTER_VAR: printf("OP_FOR_RANGE_ENTER_VAR]\n"); break;
+        case OP_FOR_RANGE_VAR: printf("OP_FOR_RANGE_VAR]\n"); break;
         case OP_CALL: printf("OP_CALL]\n"); break;
+        case OP_CALL_NATIVE: printf("OP_CALL_NATIVE]\n"); break;
+        case OP_TAIL_CALL: printf("OP_TAIL_CALL]\n"); break;
+        case OP_MEMO_LOOKUP: printf("OP_MEMO_LOOKUP]\n"); break;
+        case OP_MEMO_STORE: printf("OP_MEMO_STORE]\n"); break;
         case OP_RA_PUSH: printf("OP_RA_PUSH]\n"); break;
         case OP_RV_POP: printf("OP_RV_POP]\n"); break;
         case OP_RETURN: printf("OP_RETURN]\n"); break;
@@ -193,15 +378,16 @@ void printOp(uint8_t opCode) {
 }
 
 void printStack(VM* vm) {
-    if (vm->stack_index == 0) {
+    int stack_height = STACK_HEIGHT(vm);
+    if (stack_height == 0) {
         printf("[Stack Empty]\n");
         return;
     }
     printf("[");
-    for (int i=0; i<vm->stack_index; i++) {
+    for (int i=0; i<stack_height; i++) {
         printf("#%3d: ", i);
         debugPrintValue(vm->stack[i]);
-        if (i != vm->stack_index - 1) {
+        if (i != stack_height - 1) {
             printf(", ");
         }
     }
@@ -214,6 +400,8 @@ void printToken(Token token) {
         case  RIGHT_PAREN_T: printf("[RIGHT_PAREN_T]"); break;
         case LEFT_BRACE_T: printf("[LEFT_BRACE_T]"); break;
         case  RIGHT_BRACE_T: printf("[RIGHT_BRACE_T]"); break;
+        case LEFT_BRACKET_T: printf("[LEFT_BRACKET_T]"); break;
+        case  RIGHT_BRACKET_T: printf("[RIGHT_BRACKET_T]"); break;
         case COMMA_T: printf("[COMMA_T]"); break;
         case  DOT_T: printf("[DOT_T]"); break;
         case  MINUS_T: printf("[MINUS_T]"); break;
@@ -221,6 +409,7 @@ void printToken(Token token) {
         case  PLUS_T: printf("[PLUS_T]"); break;
         case  PLUS_EQUAL_T: printf("[PLUS_EQUAL_T]"); break;
         case SEMICOLON_T: printf("[SEMICOLON_T]"); break;
+        case COLON_T: printf("[COLON_T]"); break;
         case  SLASH_T: printf("[SLASH_T]"); break;
         case  SLASH_EQUAL_T: printf("[SLASH_EQUAL_T]"); break;
         case  STAR_T: printf("[STAR_T]"); break;
@@ -249,19 +438,138 @@ void printToken(Token token) {
         case  IF_T: printf("[IF_T]"); break;
         case  NONE_T: printf("[NONE_T]"); break;
         case  OR_T: printf("[OR_T]"); break;
-        case  LEN_T: printf("[LEN_T]"); break;
         case PRINT_T: printf("[PRINT_T]"); break;
         case PRINTLN_T: printf("[PRINTLN_T]"); break;
         case  RETURN_T: printf("[RETURN_T]"); break;
         case TRUE_T: printf("[TRUE_T]"); break;
-        case TYPE_T: printf("[TYPE_T]"); break;
         case  VAR_T: printf("[VAR_T]"); break;
         case  WHILE_T: printf("[WHILE_T]"); break;
         case  DEF_T: printf("[DEF_T]"); break;
-        case  TIME_T: printf("[TIME_T]"); break;
+        case  DEL_T: printf("[DEL_T]"); break;
+        case  IN_T: printf("[IN_T]"); break;
+        case  MEMO_T: printf("[MEMO_T]"); break;
         case ERROR_T: printf("[ERROR_T]"); break;
         case  EOF_T: printf("[EOF_T]"); break;
         default: printf("Unknown Token."); return;
     }
     printf(" %.*s\n", token.length, token.code);
 }
+
+static const char* exprOperator(TokenType op) {
+    switch (op) {
+        case PLUS_T: case PLUS_EQUAL_T: return "+";
+        case MINUS_T: case MINUS_EQUAL_T: return "-";
+        case STAR_T: case STAR_EQUAL_T: return "*";
+        case SLASH_T: case SLASH_EQUAL_T: return "/";
+        case CARET_T: case CARET_EQUAL_T: return "^";
+        case MOD_T: case MOD_EQUAL_T: return "%";
+        case BANG_EQUAL_T: return "!=";
+        case EQUAL_EQUAL_T: return "==";
+        case GREATER_T: return ">";
+        case GREATER_EQUAL_T: return ">=";
+        case LESS_T: return "<";
+        case LESS_EQUAL_T: return "<=";
+        default: return "?";
+    }
+}
+
+static void printExprArgs(ExprNode* node) {
+    for (ExprNode* arg = node->args; arg != NULL; arg = arg->next) {
+        printf(" ");
+        printExpr(arg);
+    }
+}
+
+// Prints an expression tree as nested (operator operands...) lists.
+void printExpr(ExprNode* node) {
+    switch (node->kind) {
+        case EXPR_CONSTANT: debugPrintValue(node->value); return;
+        case EXPR_VARIABLE:
+        case EXPR_HOISTED: printValue(node->value); return;
+        case EXPR_GLOBAL: printf("global "); printValue(node->value); return;
+        case EXPR_OPERAND: printf("$%d", node->index); return;
+        case EXPR_BINARY: printf("(%s ", exprOperator(node->op)); break;
+        case EXPR_SQUARE: printf("(square "); break;
+        case EXPR_NEGATE: printf("(- "); break;
+        case EXPR_AND: printf("(and "); break;
+        case EXPR_OR: printf("(or "); break;
+        case EXPR_CALL:
+            printf("(call ");
+            printValue(node->value);
+            printExprArgs(node);
+            printf(")");
+            return;
+        case EXPR_INLINE_CALL:
+            printf("(inline ");
+            printValue(node->value);
+            printExprArgs(node);
+            printf(" => ");
+            printExpr(node->left);
+            printf(")");
+            return;
+        case EXPR_LIST:
+            printf("(list");
+            printExprArgs(node);
+            printf(")");
+            return;
+        case EXPR_INDEX: printf("(index "); break;
+        case EXPR_MAP:
+            printf("(map");
+            printExprArgs(node);
+            printf(")");
+            return;
+        case EXPR_CONTAINS: printf("(in "); break;
+        case EXPR_NATIVE_CALL:
+            printf("(native ");
+            printValue(node->value);
+            printExprArgs(node);
+            printf(")");
+            return;
+    }
+    printExpr(node->left);
+    if (node->right != NULL) {
+        printf(" ");
+        printExpr(node->right);
+    }
+    printf(")");
+}
+
+
+void printMemoryStats(VM* vm) {
+    Heap* heap = &vm->heap;
+    printf("--<MEMORY>--\n");
+    printf("Heap in use:   %zu bytes\n", heap->bytes_allocated);
+    printf("Peak heap:     %zu bytes\n", heap->peak_bytes);
+    if (heap->limit != 0) {
+        printf("Heap limit:    %zu bytes%s\n", heap->limit, heap->limit_exceeded ? " (exceeded)" : "");
+    }
+    printf("Live objects:\n");
+    for (int i = 0; i < VALUE_TYPE_COUNT; i++) {
+        if (heap->live_objects[i] == 0) continue;
+        Value type_value = {(ValueType)i, {.bool_value = false}};
+        printf("  %s: %zu\n", strValueType(type_value), heap->live_objects[i]);
+    }
+    printf("Garbage collections: %d\n", vm->gc_count);
+    printf("Interned strings: %d (table capacity %d, arena %zu bytes)\n", internedStringCount(&vm->runtime->strings), internTableCapacity(&vm->runtime->strings),
+           internArenaBytes(&vm->runtime->strings));
+    printf("Strings made by the VM: %d (table capacity %d, arena %zu bytes)\n", internedStringCount(&vm->strings),
+           internTableCapacity(&vm->strings), internArenaBytes(&vm->strings));
+    printf("Size classes:\n");
+    const SizeClassStats* stats = sizeClassStats();
+    for (int i = 0; i <= SIZE_CLASS_COUNT; i++) {
+        if (i == SIZE_CLASS_COUNT) {
+            printf("  >%4d B", POOL_MAX_SIZE);
+        } else {
+            printf("  %5zu B", sizeClassBytes(i));
+        }
+        printf(" | allocated: %zu B, in use: %zu B, blocks: %zu\n", stats[i].allocated, stats[i].in_use, stats[i].count);
+    }
+}
+void printMemoStats(VM* vm) {
+    printf("--<MEMO>--\n");
+    for (int i = 0; i < vm->memo_count; i++) {
+        MemoTable* memo = &vm->memos[i];
+        printValue(vm->chunk->memo_names.values[i]);
+        printf(": %d hits, %d misses, %d cached (limit %d)\n", memo->hits, memo->misses, memo->entries.count, vm->memo_limit);
+    }
+}
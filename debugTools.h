@@ -8,10 +8,14 @@
 #include "chunk.h"
 #include "vm.h"
 #include "token.h"
+#include "ir.h"
 
 void printChunk(Chunk* chunk);
 void printOp(uint8_t opCode);
 void printStack(VM* vm);
 void printToken(Token token);
+void printExpr(ExprNode* node);
+void printMemoryStats(VM* vm);
+void printMemoStats(VM* vm);
 
 #endif //CJLANG_DEBUGTOOLS_H
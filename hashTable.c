@@ -1,10 +1,18 @@
 #include <string.h>
+#include <stdio.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "hashTable.h"
 #include "object.h"
 #include "memory.h"
 
-#define TABLE_MAX_LOAD 0.75
+// Maximum load of 7/8, tombstones included
+#define TABLE_MAX_LOAD(capacity) ((capacity) - ((capacity) >> 3))
+
+#define HASH_HIGH(hash) ((hash) >> 7)
+#define HASH_LOW(hash) ((uint8_t)((hash) & 0x7f))
 
 static void hashError(const char *message) {
     fprintf(stderr, "%s", message);
@@ -17,128 +25,343 @@ static void checkType(Value* value) {
     }
 }
 
+// Bit i of the result is set when control[i] == byte.
+static inline uint32_t groupMatch(const uint8_t* group, uint8_t byte) {
+#if defined(__SSE2__)
+    __m128i control = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8((char)byte)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < TABLE_GROUP_WIDTH; i++) {
+        if (group[i] == byte) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+// Bit i of the result is set when slot i is empty or deleted (high bit of the control byte set).
+static inline uint32_t groupMatchFree(const uint8_t* group) {
+#if defined(__SSE2__)
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < TABLE_GROUP_WIDTH; i++) {
+        if (group[i] & 0x80) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+static inline int lowestBit(uint32_t mask) {
+    return __builtin_ctz(mask);
+}
+
 void initTable(Table* table) {
     table->count = 0;
+    table->tombstones = 0;
     table->capacity = 0;
-    table->entries = NULL;
+    table->control = NULL;
+    table->keys = NULL;
+    table->values = NULL;
 }
 
 void freeTable(Table* table) {
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(uint8_t, table->control, table->capacity);
+    FREE_ARRAY(String_Object*, table->keys, table->capacity);
+    FREE_ARRAY(Value, table->values, table->capacity);
     initTable(table);
 }
 
-// NOTE: The "Optimization" chapter has a manual copy of this function.
-// If you change it here, make sure to update that copy.
-Entry* findEntry(Entry* entries, int capacity, String_Object* key) {
-    uint32_t index = key->hash % capacity;
-    Entry* tombstone = NULL;
+void clearTable(Table* table) {
+    if (table->capacity > 0) memset(table->control, TABLE_EMPTY, table->capacity);
+    table->count = 0;
+    table->tombstones = 0;
+}
+
+// Returns the slot holding key, or -1.
+static int findSlot(Table* table, String_Object* key) {
+    int group_mask = (table->capacity / TABLE_GROUP_WIDTH) - 1;
+    uint32_t group_index = HASH_HIGH(key->hash) & group_mask;
+    uint8_t low = HASH_LOW(key->hash);
 
     for (;;) {
-        Entry* entry = &entries[index];
-        if (entry->key == NULL) {
-            if (entry->value.type == NONE_TYPE) {
-                // Empty entry.
-                return tombstone != NULL ? tombstone : entry;
-            } else {
-                // We found a tombstone.
-                if (tombstone == NULL) tombstone = entry;
-            }
-        } else if (entry->key == key) {
-            // We found the key.
-            return entry;
+        int base = group_index * TABLE_GROUP_WIDTH;
+        const uint8_t* group = &table->control[base];
+        for (uint32_t match = groupMatch(group, low); match != 0; match &= match - 1) {
+            int slot = base + lowestBit(match);
+            if (table->keys[slot] == key) return slot;
         }
+        // An empty slot ends the probe sequence.
+        if (groupMatch(group, TABLE_EMPTY) != 0) return -1;
+        group_index = (group_index + 1) & group_mask;
+    }
+}
+
+// Returns the first empty or deleted slot along key's probe sequence.
+static int findFreeSlot(uint8_t* control, int capacity, uint32_t hash) {
+    int group_mask = (capacity / TABLE_GROUP_WIDTH) - 1;
+    uint32_t group_index = HASH_HIGH(hash) & group_mask;
 
-        index = (index + 1) % capacity;
+    for (;;) {
+        int base = group_index * TABLE_GROUP_WIDTH;
+        uint32_t free_slots = groupMatchFree(&control[base]);
+        if (free_slots != 0) return base + lowestBit(free_slots);
+        group_index = (group_index + 1) & group_mask;
     }
 }
 
 bool tableGet(Table* table, Value key_value, Value* value) {
     checkType(&key_value);
-    String_Object* key = key_value.content.string_object;
-
     if (table->count == 0) return false;
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    int slot = findSlot(table, key_value.content.string_object);
+    if (slot < 0) return false;
 
-    *value = entry->value;
+    *value = table->values[slot];
     return true;
 }
 
 static void adjustCapacity(Table* table, int capacity) {
-    Entry* entries = ALLOCATE(Entry, capacity);
-    for (int i = 0; i < capacity; i++) {
-        entries[i].key = NULL;
-        entries[i].value = MAKE_NONE;
-    }
+    uint8_t* control = ALLOCATE(uint8_t, capacity);
+    String_Object** keys = ALLOCATE(String_Object*, capacity);
+    Value* values = ALLOCATE(Value, capacity);
+    memset(control, TABLE_EMPTY, capacity);
 
-    table->count = 0;
     for (int i = 0; i < table->capacity; i++) {
-        Entry* entry = &table->entries[i];
-        if (entry->key == NULL) continue;
-
-        Entry* dest = findEntry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
-        table->count++;
+        if (table->control[i] & 0x80) continue;
+        String_Object* key = table->keys[i];
+        int slot = findFreeSlot(control, capacity, key->hash);
+        control[slot] = HASH_LOW(key->hash);
+        keys[slot] = key;
+        values[slot] = table->values[i];
     }
 
-    FREE_ARRAY(Entry, table->entries, table->capacity);
-    table->entries = entries;
+    FREE_ARRAY(uint8_t, table->control, table->capacity);
+    FREE_ARRAY(String_Object*, table->keys, table->capacity);
+    FREE_ARRAY(Value, table->values, table->capacity);
+    table->control = control;
+    table->keys = keys;
+    table->values = values;
     table->capacity = capacity;
+    table->tombstones = 0;
 }
 
 bool tableSet(Table* table, Value key_value, Value value) {
     checkType(&key_value);
     String_Object* key = key_value.content.string_object;
 
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
+    if (table->count > 0) {
+        int slot = findSlot(table, key);
+        if (slot >= 0) {
+            table->values[slot] = value;
+            return false;
+        }
     }
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    bool isNewKey = entry->key == NULL;
-    if (isNewKey && entry->value.type == NONE_TYPE) table->count++;
+    if (table->count + table->tombstones + 1 > TABLE_MAX_LOAD(table->capacity)) {
+        // Mostly tombstones: rehash in place, otherwise grow.
+        int capacity = table->capacity;
+        if (table->count + 1 > TABLE_MAX_LOAD(capacity) / 2) {
+            capacity = capacity < TABLE_GROUP_WIDTH ? TABLE_GROUP_WIDTH : capacity * 2;
+        }
+        adjustCapacity(table, capacity);
+    }
 
-    entry->key = key;
-    entry->value = value;
-    return isNewKey;
+    int slot = findFreeSlot(table->control, table->capacity, key->hash);
+    if (table->control[slot] == TABLE_DELETED) table->tombstones--;
+    table->control[slot] = HASH_LOW(key->hash);
+    table->keys[slot] = key;
+    table->values[slot] = value;
+    table->count++;
+    return true;
 }
 
 bool tableDelete(Table* table, Value key_value) {
     checkType(&key_value);
-    String_Object* key = key_value.content.string_object;
-
     if (table->count == 0) return false;
 
-    // Find the entry.
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    int slot = findSlot(table, key_value.content.string_object);
+    if (slot < 0) return false;
 
-    // Place a tombstone in the entry.
-    entry->key = NULL;
-    entry->value = MAKE_BOOL(true);
+    // Place a tombstone in the slot.
+    table->control[slot] = TABLE_DELETED;
+    table->keys[slot] = NULL;
+    table->count--;
+    table->tombstones++;
     return true;
 }
 
 String_Object* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
     if (table->count == 0) return NULL;
 
-    uint32_t index = hash % table->capacity;
+    int group_mask = (table->capacity / TABLE_GROUP_WIDTH) - 1;
+    uint32_t group_index = HASH_HIGH(hash) & group_mask;
+    uint8_t low = HASH_LOW(hash);
+
     for (;;) {
-        Entry* entry = &table->entries[index];
-        if (entry->key == NULL) {
-            // Stop if we find an empty non-tombstone entry.
-            if (entry->value.type == NULL) return NULL;
-        } else if (entry->key->length == length &&
-                   entry->key->hash == hash &&
-                   memcmp(entry->key->cString, chars, length) == 0) {
-            // We found it.
-            return entry->key;
+        int base = group_index * TABLE_GROUP_WIDTH;
+        const uint8_t* group = &table->control[base];
+        for (uint32_t match = groupMatch(group, low); match != 0; match &= match - 1) {
+            String_Object* key = table->keys[base + lowestBit(match)];
+            if (key->hash == hash && key->length == length &&
+                memcmp(key->cString, chars, length) == 0) {
+                // We found it.
+                return key;
+            }
         }
+        // Stop if we find an empty non-tombstone slot.
+        if (groupMatch(group, TABLE_EMPTY) != 0) return NULL;
+        group_index = (group_index + 1) & group_mask;
+    }
+}
 
-        index = (index + 1) % table->capacity;
+bool isMapKey(Value key) {
+    switch (key.type) {
+        case INTEGER_TYPE:
+        case BOOL_TYPE:
+        case OBJECT_STRING_TYPE:
+            return true;
+        case NUMBER_TYPE:
+            return key.content.number_value == key.content.number_value;
+        default:
+            return false;
+    }
+}
+
+static uint32_t hashMapKey(Value key) {
+    switch (key.type) {
+        case OBJECT_STRING_TYPE: return key.content.string_object->hash;
+        case BOOL_TYPE: return key.content.bool_value ? 0x9e3779b9u : 0x85ebca6bu;
+        default: {
+            // Hashes the double so 1 & 1.0 collide, -0 is turned into 0 for the same reason.
+            // Integers above 2^53 sharing a double collide too, sameMapKey still tells them apart.
+            double number = AS_DOUBLE(key);
+            if (number == 0) number = 0;
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            bits ^= bits >> 33;
+            bits *= 0xff51afd7ed558ccdull;
+            bits ^= bits >> 33;
+            return (uint32_t) bits;
+        }
     }
 }
+
+// Same keys as the language's ==: integers compare exactly, an integer & a double compare as doubles
+static bool sameMapKey(Value a, Value b) {
+    if (a.type == INTEGER_TYPE && b.type == INTEGER_TYPE) return a.content.integer_value == b.content.integer_value;
+    if (IS_NUMERIC(a) && IS_NUMERIC(b)) return AS_DOUBLE(a) == AS_DOUBLE(b);
+    if (a.type != b.type) return false;
+    // Strings are interned
+    if (a.type == OBJECT_STRING_TYPE) return a.content.string_object == b.content.string_object;
+    return a.content.bool_value == b.content.bool_value;
+}
+
+void initMapTable(MapTable* table) {
+    table->count = 0;
+    table->entry_count = 0;
+    table->capacity = 0;
+    table->control = NULL;
+    table->slots = NULL;
+    table->entries = NULL;
+}
+
+void freeMapTable(MapTable* table) {
+    FREE_ARRAY(uint8_t, table->control, table->capacity);
+    FREE_ARRAY(int, table->slots, table->capacity);
+    FREE_ARRAY(MapEntry, table->entries, TABLE_MAX_LOAD(table->capacity));
+    initMapTable(table);
+}
+
+// Returns the slot referring to key's entry, or -1.
+static int findMapSlot(MapTable* table, Value key, uint32_t hash) {
+    int group_mask = (table->capacity / TABLE_GROUP_WIDTH) - 1;
+    uint32_t group_index = HASH_HIGH(hash) & group_mask;
+    uint8_t low = HASH_LOW(hash);
+
+    for (;;) {
+        int base = group_index * TABLE_GROUP_WIDTH;
+        const uint8_t* group = &table->control[base];
+        for (uint32_t match = groupMatch(group, low); match != 0; match &= match - 1) {
+            int slot = base + lowestBit(match);
+            if (sameMapKey(table->entries[table->slots[slot]].key, key)) return slot;
+        }
+        if (groupMatch(group, TABLE_EMPTY) != 0) return -1;
+        group_index = (group_index + 1) & group_mask;
+    }
+}
+
+bool mapTableGet(MapTable* table, Value key, Value* value) {
+    if (table->count == 0) return false;
+    int slot = findMapSlot(table, key, hashMapKey(key));
+    if (slot < 0) return false;
+    *value = table->entries[table->slots[slot]].value;
+    return true;
+}
+
+// Drops the deleted entries keeping the order of the others, then indexes them in a new set of slots.
+static void rehashMap(MapTable* table, int capacity) {
+    MapEntry* entries = ALLOCATE(MapEntry, TABLE_MAX_LOAD(capacity));
+    int count = 0;
+    for (int i = 0; i < table->entry_count; i++) {
+        if (table->entries[i].key.type != NONE_TYPE) entries[count++] = table->entries[i];
+    }
+    FREE_ARRAY(uint8_t, table->control, table->capacity);
+    FREE_ARRAY(int, table->slots, table->capacity);
+    FREE_ARRAY(MapEntry, table->entries, TABLE_MAX_LOAD(table->capacity));
+    table->control = ALLOCATE(uint8_t, capacity);
+    table->slots = ALLOCATE(int, capacity);
+    memset(table->control, TABLE_EMPTY, capacity);
+    for (int i = 0; i < count; i++) {
+        uint32_t hash = hashMapKey(entries[i].key);
+        int slot = findFreeSlot(table->control, capacity, hash);
+        table->control[slot] = HASH_LOW(hash);
+        table->slots[slot] = i;
+    }
+    table->entries = entries;
+    table->entry_count = count;
+    table->capacity = capacity;
+}
+
+bool mapTableSet(MapTable* table, Value key, Value value) {
+    uint32_t hash = hashMapKey(key);
+    if (table->count > 0) {
+        int slot = findMapSlot(table, key, hash);
+        if (slot >= 0) {
+            table->entries[table->slots[slot]].value = value;
+            return false;
+        }
+    }
+
+    // Every used or deleted slot has an entry, a full entry array bounds the load
+    if (table->entry_count + 1 > TABLE_MAX_LOAD(table->capacity)) {
+        // Mostly deleted entries: compact in place, otherwise grow.
+        int capacity = table->capacity;
+        if (table->count + 1 > TABLE_MAX_LOAD(capacity) / 2) {
+            capacity = capacity < TABLE_GROUP_WIDTH ? TABLE_GROUP_WIDTH : capacity * 2;
+        }
+        rehashMap(table, capacity);
+    }
+
+    int slot = findFreeSlot(table->control, table->capacity, hash);
+    table->control[slot] = HASH_LOW(hash);
+    table->slots[slot] = table->entry_count;
+    table->entries[table->entry_count].key = key;
+    table->entries[table->entry_count].value = value;
+    table->entry_count++;
+    table->count++;
+    return true;
+}
+
+bool mapTableDelete(MapTable* table, Value key) {
+    if (table->count == 0) return false;
+    int slot = findMapSlot(table, key, hashMapKey(key));
+    if (slot < 0) return false;
+
+    MapEntry* entry = &table->entries[table->slots[slot]];
+    entry->key = MAKE_NONE;
+    entry->value = MAKE_NONE;
+    table->control[slot] = TABLE_DELETED;
+    table->count--;
+    return true;
+}
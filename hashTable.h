@@ -7,22 +7,58 @@
 
 #include "value.h"
 
-typedef struct {
-    String_Object* key;
-    Value value;
-} Entry;
+// Open addressing table probed in groups of TABLE_GROUP_WIDTH slots.
+// Each slot has a control byte: TABLE_EMPTY, TABLE_DELETED, or the low 7 bits of the key's hash.
+// Capacity is always a power of two, so indexing is a mask instead of a division.
+#define TABLE_GROUP_WIDTH 16
+#define TABLE_EMPTY ((uint8_t)0x80)
+#define TABLE_DELETED ((uint8_t)0xFE)
 
 typedef struct {
     int count;
+    int tombstones;
     int capacity;
-    Entry* entries;
+    uint8_t* control;
+    String_Object** keys;
+    Value* values;
 } Table;
 
 void initTable(Table* table);
 void freeTable(Table* table);
+// Removes every entry, the capacity is kept
+void clearTable(Table* table);
 bool tableGet(Table* table, Value key_value, Value* value);
 bool tableSet(Table* table, Value key_value, Value value);
 bool tableDelete(Table* table, Value key_value);
 String_Object* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
 
+// Table keyed by numbers, bools & strings, probed like Table & iterated in insertion order.
+// Entries are appended to a dense array, each used slot holds the index of its entry.
+// A deleted entry keeps its place with a None key until the next rehash compacts the array.
+typedef struct {
+    Value key;
+    Value value;
+} MapEntry;
+
+typedef struct {
+    // Live entries, & entries appended since the last rehash, deleted ones included
+    int count;
+    int entry_count;
+    int capacity;
+    uint8_t* control;
+    int* slots;
+    // Room for the maximum load of the slots
+    MapEntry* entries;
+} MapTable;
+
+// Numbers equal to each other are the same key, whether integers or not. NaN can't be a key.
+bool isMapKey(Value key);
+void initMapTable(MapTable* table);
+void freeMapTable(MapTable* table);
+// The key must pass isMapKey
+bool mapTableGet(MapTable* table, Value key, Value* value);
+// Returns true if the key is new, it then goes after every other entry
+bool mapTableSet(MapTable* table, Value key, Value value);
+bool mapTableDelete(MapTable* table, Value key);
+
 #endif //CJLANG_HASHTABLE_H
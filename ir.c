@@ -0,0 +1,165 @@
+// Module responsible for the intermediate representation of expressions.
+
+#include <string.h>
+
+#include "ir.h"
+#include "memory.h"
+#include "number.h"
+#include "makeString.h"
+
+#define ARENA_BLOCK_SIZE (16 * 1024)
+#define ARENA_ALIGN(size) (((size) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+struct ArenaBlock {
+    ArenaBlock* next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+void initArena(Arena* arena) {
+    arena->first = NULL;
+    arena->current = NULL;
+}
+
+void* arenaAllocate(Arena* arena, size_t size) {
+    size = ARENA_ALIGN(size);
+    while (arena->current == NULL || arena->current->used + size > arena->current->size) {
+        ArenaBlock* next = arena->current == NULL ? arena->first : arena->current->next;
+        if (next == NULL) {
+            size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+            next = reallocate(NULL, 0, sizeof(ArenaBlock) + block_size);
+            next->next = NULL;
+            next->used = 0;
+            next->size = block_size;
+            if (arena->current == NULL) {
+                arena->first = next;
+            } else {
+                arena->current->next = next;
+            }
+        }
+        arena->current = next;
+    }
+    void* allocated = arena->current->data + arena->current->used;
+    arena->current->used += size;
+    return allocated;
+}
+
+void resetArena(Arena* arena) {
+    for (ArenaBlock* block = arena->first; block != NULL; block = block->next) {
+        block->used = 0;
+    }
+    arena->current = arena->first;
+}
+
+void freeArena(Arena* arena) {
+    ArenaBlock* block = arena->first;
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        reallocate(block, sizeof(ArenaBlock) + block->size, 0);
+        block = next;
+    }
+    initArena(arena);
+}
+
+ExprNode* newExprNode(Arena* arena, ExprKind kind, Token first) {
+    ExprNode* node = arenaAllocate(arena, sizeof(ExprNode));
+    memset(node, 0, sizeof(ExprNode));
+    node->kind = kind;
+    node->type = TYPE_UNKNOWN;
+    node->value = MAKE_NONE;
+    node->first = first;
+    node->last = first;
+    return node;
+}
+
+StaticType constantType(Value value) {
+    switch (value.type) {
+        case NUMBER_TYPE:
+        case INTEGER_TYPE: return TYPE_NUMBER;
+        case BOOL_TYPE: return TYPE_BOOL;
+        case OBJECT_STRING_TYPE: return TYPE_STRING;
+        case NONE_TYPE: return TYPE_NONE;
+        default: return TYPE_UNKNOWN;
+    }
+}
+
+// Computes an operator on two constants the way the VM would at runtime.
+// Returns false if the operation fails, the VM reports that error when it gets there.
+static bool foldBinary(StringSet* strings, TokenType operatorType, Value a, Value b, Value* result) {
+    if (operatorType == PLUS_T && a.type == OBJECT_STRING_TYPE && b.type == OBJECT_STRING_TYPE) {
+        *result = concatStrValues(strings, a.content.string_object, b.content.string_object);
+        return true;
+    }
+    if (!IS_NUMERIC(a) || !IS_NUMERIC(b)) return false;
+    switch (operatorType) {
+        case PLUS_T:          *result = addNumbers(a, b); break;
+        case MINUS_T:         *result = subtractNumbers(a, b); break;
+        case STAR_T:          *result = multiplyNumbers(a, b); break;
+        case SLASH_T:         *result = divideNumbers(a, b); break;
+        case CARET_T:         *result = powerNumbers(a, b); break;
+        case MOD_T:           *result = modNumbers(a, b); break;
+        case BANG_EQUAL_T:    *result = MAKE_BOOL(!equalNumbers(a, b).content.bool_value); break;
+        case EQUAL_EQUAL_T:   *result = equalNumbers(a, b); break;
+        case GREATER_T:       *result = greaterNumbers(a, b); break;
+        case GREATER_EQUAL_T: *result = MAKE_BOOL(!lessNumbers(a, b).content.bool_value); break;
+        case LESS_T:          *result = lessNumbers(a, b); break;
+        case LESS_EQUAL_T:    *result = MAKE_BOOL(!greaterNumbers(a, b).content.bool_value); break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+static void makeConstant(ExprNode* node, Value value) {
+    node->kind = EXPR_CONSTANT;
+    node->value = value;
+    node->type = constantType(value);
+    node->left = NULL;
+    node->right = NULL;
+}
+
+// Replaces operations on constants with their result, bottom up.
+void foldConstants(ExprNode* node, StringSet* strings) {
+    if (node->left != NULL) foldConstants(node->left, strings);
+    if (node->right != NULL) foldConstants(node->right, strings);
+    for (ExprNode* arg = node->args; arg != NULL; arg = arg->next) {
+        foldConstants(arg, strings);
+    }
+    Value folded;
+    switch (node->kind) {
+        case EXPR_BINARY:
+            if (node->left->kind == EXPR_CONSTANT && node->right->kind == EXPR_CONSTANT &&
+                foldBinary(strings, node->op, node->left->value, node->right->value, &folded)) {
+                makeConstant(node, folded);
+            }
+            break;
+        case EXPR_NEGATE: {
+            if (node->left->kind != EXPR_CONSTANT) break;
+            Value operand = node->left->value;
+            if (operand.type == BOOL_TYPE) {
+                makeConstant(node, MAKE_BOOL(!operand.content.bool_value));
+            } else if (IS_NUMERIC(operand)) {
+                makeConstant(node, negateNumber(operand));
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Replaces operations with cheaper ones computing the same result.
+void reduceStrength(ExprNode* node) {
+    if (node->left != NULL) reduceStrength(node->left);
+    if (node->right != NULL) reduceStrength(node->right);
+    for (ExprNode* arg = node->args; arg != NULL; arg = arg->next) {
+        reduceStrength(arg);
+    }
+    // Squaring multiplies the operand with a copy of itself, the same result without the power loop
+    if (node->kind == EXPR_BINARY && (node->op == CARET_T || node->op == CARET_EQUAL_T) &&
+        node->right->kind == EXPR_CONSTANT && IS_NUMERIC(node->right->value) && AS_DOUBLE(node->right->value) == 2) {
+        node->kind = EXPR_SQUARE;
+        node->right = NULL;
+    }
+}
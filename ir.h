@@ -0,0 +1,90 @@
+// Module responsible for the intermediate representation of expressions.
+// The parser builds a tree per expression in an arena, passes rewrite the tree before the compiler emits its bytecode.
+
+#ifndef CJLANG_IR_H
+#define CJLANG_IR_H
+
+#include "imports.h"
+#include "value.h"
+#include "token.h"
+#include "makeString.h"
+
+// Type of a value known at compile time.
+typedef enum {
+    TYPE_UNKNOWN,
+    TYPE_NUMBER,
+    TYPE_BOOL,
+    TYPE_STRING,
+    TYPE_NONE,
+    TYPE_NEVER, // No value produced yet, e.g. a function without any return so far
+} StaticType;
+
+typedef enum {
+    EXPR_CONSTANT,
+    EXPR_VARIABLE,    // Local or global, resolved at runtime in functions
+    EXPR_GLOBAL,      // Global read inside an inlined function body
+    EXPR_OPERAND,     // Operand of an inlined call, read off the stack
+    EXPR_HOISTED,     // Hidden variable holding a loop invariant
+    EXPR_BINARY,
+    EXPR_SQUARE,      // Operand multiplied with itself
+    EXPR_NEGATE,
+    EXPR_AND,
+    EXPR_OR,
+    EXPR_CALL,
+    EXPR_INLINE_CALL, // Arguments pushed, then the callee's return expression
+    EXPR_NATIVE_CALL, // Arguments pushed, then the native function called on them
+    EXPR_LIST,        // New list holding the values of args
+    EXPR_INDEX,       // Item of the list or map in left at the index or key in right
+    EXPR_MAP,         // New map holding the key & value pairs in args
+    EXPR_CONTAINS,    // Whether the map in right has the key in left
+} ExprKind;
+
+typedef struct ExprNode {
+    ExprKind kind;
+    StaticType type;
+    // Operator of a binary expression
+    TokenType op;
+    // Value of a constant, name of a variable or of the function called
+    Value value;
+    // Operands, the inlined body of a call in left
+    struct ExprNode* left;
+    struct ExprNode* right;
+    // Arguments of a call, linked through next
+    struct ExprNode* args;
+    struct ExprNode* next;
+    int arg_count;
+    // Index of an inlined call's operand & the call it belongs to, or of the native function called
+    int index;
+    struct ExprNode* call;
+    // Loop depth a hoisted variable got computed in front of
+    int invariant_depth;
+    // Operand stack height below an inlined call's arguments, known once it's emitted
+    int base_depth;
+    // First & last token of the expression in the source
+    Token first;
+    Token last;
+} ExprNode;
+
+typedef struct ArenaBlock ArenaBlock;
+
+// Bump allocator, everything it handed out is released at once.
+typedef struct {
+    ArenaBlock* first;
+    ArenaBlock* current;
+} Arena;
+
+void initArena(Arena* arena);
+void* arenaAllocate(Arena* arena, size_t size);
+// Keeps the blocks for the next allocations
+void resetArena(Arena* arena);
+void freeArena(Arena* arena);
+
+ExprNode* newExprNode(Arena* arena, ExprKind kind, Token first);
+StaticType constantType(Value value);
+
+// Passes, each rewrites the tree in place
+// Folded strings get interned in strings
+void foldConstants(ExprNode* node, StringSet* strings);
+void reduceStrength(ExprNode* node);
+
+#endif //CJLANG_IR_H
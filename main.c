@@ -8,6 +8,7 @@
 #include "object.h"
 #include "makeString.h"
 #include <time.h>
+#include <pthread.h>
 
 
 // This function responsible for working with sourcecode file.
@@ -41,40 +42,201 @@ static char* readFile(const char* path) {
     return buffer;
 }
 
+static void usage() {
+    fprintf(stderr, "Usage: cjlang [--mem-stats] [--heap-limit <bytes>[k|m|g]] [--max-depth <calls>] [--no-inline] [--no-hoist] [--dump-ir] [--dump-chunk] [--memo-stats] [--memo-limit <entries>] [--jobs <n>] <source file>\n");
+    exit(64);
+}
+
+// Parses a byte count with an optional k/m/g suffix.
+static size_t parseSize(const char* arg) {
+    char* end;
+    size_t size = strtoull(arg, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; end++; break;
+        case 'm': case 'M': size <<= 20; end++; break;
+        case 'g': case 'G': size <<= 30; end++; break;
+        default: break;
+    }
+    if (end == arg || *end != '\0') usage();
+    return size;
+}
+
+static double wallClock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// One copy of the script run by --jobs, on a VM of its own.
+typedef struct {
+    Runtime* runtime;
+    const Chunk* chunk;
+    size_t heap_limit;
+    int max_depth;
+    int memo_limit;
+    OperationResult result;
+    double seconds;
+    pthread_t thread;
+} Job;
+
+// Runs the job's chunk on a VM allocated on the calling thread, the chunk & runtime are only read.
+static void runJob(Job* job) {
+    double start = wallClock();
+    VM vm;
+    initVM(&vm, job->runtime, job->chunk);
+    vm.heap.limit = job->heap_limit;
+    vm.max_call_depth = job->max_depth;
+    vm.memo_limit = job->memo_limit;
+    job->result = run(&vm);
+    freeVM(&vm);
+    job->seconds = wallClock() - start;
+}
+
+static void* runJobThread(void* arg) {
+    runJob((Job*)arg);
+    // The pools of the main thread still hold the chunk, the job's own are done
+    freeMemoryPools();
+    return NULL;
+}
+
+// Runs the compiled script once alone, then jobs copies at once on as many threads, all sharing one chunk.
+// With a core per copy, the copies together take about as long as the single one: the scaling is near linear.
+static int runJobs(Job* template, int jobs) {
+    Job single = *template;
+    runJob(&single);
+    if (single.result != RUNTIME_SUCCESS) return 70;
+
+    Job* copies = (Job*)malloc(sizeof(Job) * jobs);
+    if (copies == NULL) {
+        fprintf(stderr, "Not enough memory for %d jobs.\n", jobs);
+        exit(74);
+    }
+    double start = wallClock();
+    for (int i = 0; i < jobs; i++) {
+        copies[i] = *template;
+        if (pthread_create(&copies[i].thread, NULL, runJobThread, &copies[i]) != 0) {
+            fprintf(stderr, "Could not start job %d.\n", i + 1);
+            exit(71);
+        }
+    }
+    double job_seconds = 0;
+    bool failed = false;
+    for (int i = 0; i < jobs; i++) {
+        pthread_join(copies[i].thread, NULL);
+        job_seconds += copies[i].seconds;
+        if (copies[i].result != RUNTIME_SUCCESS) failed = true;
+    }
+    double wall = wallClock() - start;
+    free(copies);
+
+    printf("--<JOBS>--\n");
+    printf("1 job took %f seconds\n", single.seconds);
+    printf("%d jobs took %f seconds, %f seconds per job on average\n", jobs, wall, job_seconds / jobs);
+    double speedup = single.seconds * jobs / wall;
+    printf("Speedup %.2fx, %.0f%% of linear\n", speedup, speedup * 100 / jobs);
+    return failed ? 70 : 0;
+}
+
 int main(int argc, const char* argv[]) {
-    if (argc == 1) {
+    const char* path = NULL;
+    bool mem_stats = false;
+    size_t heap_limit = 0;
+    int max_depth = DEFAULT_MAX_CALL_DEPTH;
+    bool memo_stats = false;
+    bool dump_chunk = false;
+    int memo_limit = DEFAULT_MEMO_LIMIT;
+    int jobs = 0;
+    CompileOptions options;
+    initCompileOptions(&options);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--mem-stats") == 0) {
+            mem_stats = true;
+        } else if (strcmp(argv[i], "--heap-limit") == 0) {
+            if (++i == argc) usage();
+            heap_limit = parseSize(argv[i]);
+        } else if (strcmp(argv[i], "--max-depth") == 0) {
+            if (++i == argc) usage();
+            max_depth = (int)parseSize(argv[i]);
+            if (max_depth <= 0) usage();
+        } else if (strcmp(argv[i], "--no-inline") == 0) {
+            options.inline_functions = false;
+        } else if (strcmp(argv[i], "--no-hoist") == 0) {
+            options.hoist_invariants = false;
+        } else if (strcmp(argv[i], "--dump-ir") == 0) {
+            options.dump_ir = true;
+        } else if (strcmp(argv[i], "--dump-chunk") == 0) {
+            dump_chunk = true;
+        } else if (strcmp(argv[i], "--memo-stats") == 0) {
+            memo_stats = true;
+        } else if (strcmp(argv[i], "--memo-limit") == 0) {
+            if (++i == argc) usage();
+            memo_limit = (int)parseSize(argv[i]);
+        } else if (strcmp(argv[i], "--jobs") == 0) {
+            if (++i == argc) usage();
+            jobs = (int)parseSize(argv[i]);
+            if (jobs <= 0) usage();
+        } else if (argv[i][0] == '-' || path != NULL) {
+            usage();
+        } else {
+            path = argv[i];
+        }
+    }
+
+    if (path == NULL) {
         fprintf(stderr, "No source file given.\n");
         exit(64);
     }
-    initStrTable();
+    char* source = readFile(path);
+
+    Runtime runtime;
+    initRuntime(&runtime);
 
     Chunk chunk;
     initChunk(&chunk);
-    char* source = readFile(argv[1]);
 
     printf("--<TOKENIZE>--\n");
-    if (!compile(source, &chunk)) {
+    if (!compile(&runtime, source, &chunk, &options)) {
         printf("Compile Failed");
         exit(64);
     }
 
-    printChunk(&chunk);
+    if (dump_chunk) printChunk(&chunk);
+
+    if (jobs > 0) {
+        Job template = {&runtime, &chunk, heap_limit, max_depth, memo_limit};
+        int status = runJobs(&template, jobs);
+        resetChunk(&chunk);
+        freeRuntime(&runtime);
+        free(source);
+        return status;
+    }
 
     VM vm;
-    initVM(&vm, &chunk);
+    initVM(&vm, &runtime, &chunk);
+    vm.heap.limit = heap_limit;
+    vm.max_call_depth = max_depth;
+    vm.memo_limit = memo_limit;
     printf("--<RUNTIME>--\n");
 
     // Timing
     clock_t t;
     t = clock();
 
-    run(&vm);
+    OperationResult result = run(&vm);
 
     t = clock() - t;
     double time_taken = ((double)t)/CLOCKS_PER_SEC;
     printf("Program took %f seconds to execute \n", time_taken);
 
-    return 0;
+    if (mem_stats) printMemoryStats(&vm);
+    if (memo_stats) printMemoStats(&vm);
+    freeVM(&vm);
+    resetChunk(&chunk);
+    freeRuntime(&runtime);
+    free(source);
+
+    return result == RUNTIME_SUCCESS ? 0 : 70;
 }
 
 static int fib(int n) {
@@ -1,38 +1,233 @@
 //
 // Created by Congyu Luo on 9/29/22.
 //
+#include <string.h>
+
 #include "value.h"
 #include "memory.h"
 #include "object.h"
-#include "hashTable.h"
+#include "makeString.h"
+
+#define STRING_SET_MAX_LOAD(capacity) (((capacity) >> 2) * 3)
+#define STRING_ARENA_BLOCK_SIZE (32 * 1024)
+
+struct StringArenaBlock {
+    StringArenaBlock* next;
+    size_t used;
+    size_t capacity;
+    char bytes[];
+};
+
+void initStrTable(StringSet* strings) {
+    strings->count = 0;
+    strings->capacity = 0;
+    strings->entries = NULL;
+    strings->arena = NULL;
+    strings->arena_bytes = 0;
+    strings->parent = NULL;
+}
+
+void initLayeredStrTable(StringSet* strings, const StringSet* parent) {
+    initStrTable(strings);
+    strings->parent = parent;
+}
+
+void freeStrTable(StringSet* strings) {
+    StringArenaBlock* block = strings->arena;
+    while (block != NULL) {
+        StringArenaBlock* next = block->next;
+        reallocate(block, sizeof(StringArenaBlock) + block->capacity, 0);
+        block = next;
+    }
+    FREE_ARRAY(InternEntry, strings->entries, strings->capacity);
+    const StringSet* parent = strings->parent;
+    initStrTable(strings);
+    strings->parent = parent;
+}
+
+void clearStrTable(StringSet* strings) {
+    StringArenaBlock* kept = strings->arena;
+    if (kept != NULL) {
+        StringArenaBlock* block = kept->next;
+        while (block != NULL) {
+            StringArenaBlock* next = block->next;
+            reallocate(block, sizeof(StringArenaBlock) + block->capacity, 0);
+            block = next;
+        }
+        kept->next = NULL;
+        kept->used = 0;
+        strings->arena_bytes = kept->capacity;
+    }
+    for (int i = 0; i < strings->capacity; i++) {
+        strings->entries[i].string = NULL;
+    }
+    strings->count = 0;
+}
+
+int internedStringCount(StringSet* strings) {
+    return strings->count;
+}
+
+int internTableCapacity(StringSet* strings) {
+    return strings->capacity;
+}
 
-Table strings;
+size_t internArenaBytes(StringSet* strings) {
+    return strings->arena_bytes;
+}
+
+static void adjustCapacity(StringSet* strings, int capacity) {
+    InternEntry* entries = ALLOCATE(InternEntry, capacity);
+    for (int i = 0; i < capacity; i++) {
+        entries[i].string = NULL;
+    }
 
-void initStrTable() {
-    initTable(&strings);
+    int mask = capacity - 1;
+    for (int i = 0; i < strings->capacity; i++) {
+        InternEntry* entry = &strings->entries[i];
+        if (entry->string == NULL) continue;
+        uint32_t index = entry->hash & mask;
+        while (entries[index].string != NULL) index = (index + 1) & mask;
+        entries[index] = *entry;
+    }
+
+    FREE_ARRAY(InternEntry, strings->entries, strings->capacity);
+    strings->entries = entries;
+    strings->capacity = capacity;
 }
 
-Value allocateStringValue(char* string, int len) {
-    String_Object* str_obj = (String_Object*)reallocate(NULL, 0, sizeof(String_Object));
-    str_obj->length = len;
-    str_obj->cString = string;
-    str_obj->hash = hashString(str_obj->cString, str_obj->length);
+void reserveStrTable(StringSet* strings, int count) {
+    int capacity = strings->capacity < 8 ? 8 : strings->capacity;
+    while (count > STRING_SET_MAX_LOAD(capacity)) capacity *= 2;
+    if (capacity != strings->capacity) adjustCapacity(strings, capacity);
+}
 
+// Returns the entry holding the string, or the empty entry it would be inserted into.
+static InternEntry* findEntry(const StringSet* strings, const char* chars, int length, uint32_t hash) {
+    uint32_t mask = strings->capacity - 1;
+    uint32_t index = hash & mask;
+    for (;;) {
+        InternEntry* entry = &strings->entries[index];
+        if (entry->string == NULL) return entry;
+        if (entry->hash == hash && entry->string->length == length &&
+            memcmp(entry->string->cString, chars, length) == 0) {
+            return entry;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+// Carves a string object & room for its characters out of the arena.
+static String_Object* arenaAllocateString(StringSet* strings, int length) {
+    size_t size = (sizeof(String_Object) + length + 1 + 7) & ~(size_t)7;
+    StringArenaBlock* block = strings->arena;
+    if (block == NULL || block->capacity - block->used < size) {
+        size_t capacity = size > STRING_ARENA_BLOCK_SIZE / 4 ? size : STRING_ARENA_BLOCK_SIZE;
+        StringArenaBlock* new_block = (StringArenaBlock*)reallocate(NULL, 0, sizeof(StringArenaBlock) + capacity);
+        new_block->used = 0;
+        new_block->capacity = capacity;
+        strings->arena_bytes += capacity;
+        if (block != NULL && capacity == size) {
+            // Oversized string, keep filling the current block afterwards.
+            new_block->next = block->next;
+            block->next = new_block;
+        } else {
+            new_block->next = block;
+            strings->arena = new_block;
+        }
+        block = new_block;
+    }
+    String_Object* str_obj = (String_Object*)&block->bytes[block->used];
+    block->used += size;
+    str_obj->length = length;
+    str_obj->cString = (char*)(str_obj + 1);
+    heapObjectAllocated(OBJECT_STRING_TYPE);
+    return str_obj;
+}
+
+static Value internString(StringSet* strings, InternEntry* entry, String_Object* str_obj, uint32_t hash) {
+    str_obj->cString[str_obj->length] = '\0';
+    str_obj->hash = hash;
+    entry->hash = hash;
+    entry->string = str_obj;
+    strings->count++;
     return MAKE_OBJ_STRING(str_obj);
 }
 
-Value makeStrValue(const char* chars, int length) {
+static void ensureCapacity(StringSet* strings) {
+    if (strings->count + 1 > STRING_SET_MAX_LOAD(strings->capacity)) {
+        adjustCapacity(strings, GROW_CAPACITY(strings->capacity));
+    }
+}
+
+// Returns the string interned in the parent sets, or NULL.
+static String_Object* findInParents(const StringSet* strings, const char* chars, int length, uint32_t hash) {
+    for (const StringSet* parent = strings->parent; parent != NULL; parent = parent->parent) {
+        if (parent->capacity == 0) continue;
+        String_Object* found = findEntry(parent, chars, length, hash)->string;
+        if (found != NULL) return found;
+    }
+    return NULL;
+}
+
+Value makeStrValue(StringSet* strings, const char* chars, int length) {
     // Returns the interned string_value object of one with same content has been created
-    // Else, create a new string object using the given char* chars
-    Value newValue;
+    // Else, copy chars into a new interned string object
+    uint32_t hash = hashString(chars, length);
+    String_Object* inherited = findInParents(strings, chars, length, hash);
+    if (inherited != NULL) return MAKE_OBJ_STRING(inherited);
+    ensureCapacity(strings);
+    InternEntry* entry = findEntry(strings, chars, length, hash);
+    if (entry->string != NULL) {
+        return MAKE_OBJ_STRING(entry->string);
+    }
+
+    String_Object* str_obj = arenaAllocateString(strings, length);
+    memcpy(str_obj->cString, chars, length);
+    return internString(strings, entry, str_obj, hash);
+}
 
+// Returns the interned string with these characters, or NULL without interning them.
+String_Object* findInternedString(StringSet* strings, const char* chars, int length) {
     uint32_t hash = hashString(chars, length);
-    String_Object* interned = tableFindString(&strings, chars, length, hash);
-    if (interned != NULL) {
-        return MAKE_OBJ_STRING(interned);
+    String_Object* inherited = findInParents(strings, chars, length, hash);
+    if (inherited != NULL || strings->capacity == 0) return inherited;
+    return findEntry(strings, chars, length, hash)->string;
+}
+
+static bool matchesConcat(String_Object* candidate, String_Object* a, String_Object* b) {
+    return candidate->length == a->length + b->length &&
+           memcmp(candidate->cString, a->cString, a->length) == 0 &&
+           memcmp(candidate->cString + a->length, b->cString, b->length) == 0;
+}
+
+// Returns the entry holding a & b concatenated, or the empty entry it would be inserted into.
+static InternEntry* findConcatEntry(const StringSet* strings, String_Object* a, String_Object* b, uint32_t hash) {
+    uint32_t mask = strings->capacity - 1;
+    uint32_t index = hash & mask;
+    for (;;) {
+        InternEntry* entry = &strings->entries[index];
+        if (entry->string == NULL) return entry;
+        if (entry->hash == hash && matchesConcat(entry->string, a, b)) return entry;
+        index = (index + 1) & mask;
+    }
+}
+
+Value concatStrValues(StringSet* strings, String_Object* a, String_Object* b) {
+    // The hash is computed incrementally, so an already interned result needs no allocation
+    int length = a->length + b->length;
+    uint32_t hash = hashContinue(a->hash, b->cString, b->length);
+    for (const StringSet* parent = strings->parent; parent != NULL; parent = parent->parent) {
+        if (parent->capacity == 0) continue;
+        InternEntry* inherited = findConcatEntry(parent, a, b, hash);
+        if (inherited->string != NULL) return MAKE_OBJ_STRING(inherited->string);
     }
+    ensureCapacity(strings);
+    InternEntry* entry = findConcatEntry(strings, a, b, hash);
+    if (entry->string != NULL) return MAKE_OBJ_STRING(entry->string);
 
-    newValue = allocateStringValue(chars, length);
-    tableSet(&strings, newValue, MAKE_NONE);
-    return newValue;
+    String_Object* str_obj = arenaAllocateString(strings, length);
+    memcpy(str_obj->cString, a->cString, a->length);
+    memcpy(str_obj->cString + a->length, b->cString, b->length);
+    return internString(strings, entry, str_obj, hash);
 }
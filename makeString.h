@@ -5,9 +5,40 @@
 #ifndef CJLANG_MAKESTRING_H
 #define CJLANG_MAKESTRING_H
 
-void initStrTable();
+#include "value.h"
 
-Value allocateStringValue(char* string, int len);
-Value makeStrValue(char* chars, int length);
+// Interned strings are stored as (hash, pointer) pairs in an open addressing set.
+// The String_Object headers and their characters are packed together in an arena.
+typedef struct {
+    uint32_t hash;
+    String_Object* string;
+} InternEntry;
+
+typedef struct StringArenaBlock StringArenaBlock;
+
+typedef struct StringSet {
+    int count;
+    int capacity;
+    InternEntry* entries;
+    StringArenaBlock* arena;
+    size_t arena_bytes;
+    // Read only set looked up first, strings missing from both are added to this one
+    const struct StringSet* parent;
+} StringSet;
+
+void initStrTable(StringSet* strings);
+// Set whose new strings don't touch parent, the strings already interned there keep their pointers
+void initLayeredStrTable(StringSet* strings, const StringSet* parent);
+void freeStrTable(StringSet* strings);
+// Drops every string, the table & one arena block are kept for the next ones
+void clearStrTable(StringSet* strings);
+void reserveStrTable(StringSet* strings, int count);
+int internedStringCount(StringSet* strings);
+int internTableCapacity(StringSet* strings);
+size_t internArenaBytes(StringSet* strings);
+
+Value makeStrValue(StringSet* strings, const char* chars, int length);
+Value concatStrValues(StringSet* strings, String_Object* a, String_Object* b);
+String_Object* findInternedString(StringSet* strings, const char* chars, int length);
 
 #endif //CJLANG_MAKESTRING_H
@@ -1,18 +1,186 @@
 // Module responsible for working with memory.
 // Copied & modified from cLox code by Robert Nystrom
 
+#include <string.h>
+
 #include "memory.h"
 #include "imports.h"
 
+typedef struct FreeBlock {
+    struct FreeBlock* next;
+} FreeBlock;
+
+typedef struct Slab {
+    struct Slab* next;
+} Slab;
+
+typedef struct {
+    FreeBlock* free_list;
+    char* cursor;
+    char* end;
+} SizeClass;
+
+// Each thread allocates from pools of its own & charges the heap it's using, so VMs running on separate threads
+// never contend for the allocator. A block must be freed on the thread that allocated it.
+static _Thread_local SizeClass size_classes[SIZE_CLASS_COUNT];
+static _Thread_local SizeClassStats stats[SIZE_CLASS_COUNT + 1];
+static _Thread_local Slab* slabs = NULL;
+static _Thread_local Heap* current_heap = NULL;
+
+static void memoryError() {
+    fprintf(stderr, "Out of memory.");
+    exit(1);
+}
+
+// Index of the smallest size class fitting size, SIZE_CLASS_COUNT if none does.
+static int sizeClassOf(size_t size) {
+    if (size <= POOL_MIN_SIZE) return 0;
+    if (size > POOL_MAX_SIZE) return SIZE_CLASS_COUNT;
+    // 17..32 -> 1, 33..64 -> 2, ...
+    return (int)(sizeof(unsigned int) * 8) - __builtin_clz((unsigned int)(size - 1)) - 4;
+}
+
+size_t sizeClassBytes(int size_class) {
+    return (size_t)POOL_MIN_SIZE << size_class;
+}
+
+static void refillSizeClass(SizeClass* size_class) {
+    Slab* slab = (Slab*)malloc(POOL_SLAB_SIZE);
+    if (slab == NULL) memoryError();
+    slab->next = slabs;
+    slabs = slab;
+    // Blocks are carved from the slab lazily, keep them 16 byte aligned
+    size_class->cursor = (char*)slab + POOL_MIN_SIZE;
+    size_class->end = (char*)slab + POOL_SLAB_SIZE;
+}
+
+static void* poolAllocate(int index) {
+    SizeClass* size_class = &size_classes[index];
+    size_t bytes = sizeClassBytes(index);
+    stats[index].allocated += bytes;
+    stats[index].in_use += bytes;
+    stats[index].count++;
+
+    FreeBlock* block = size_class->free_list;
+    if (block != NULL) {
+        size_class->free_list = block->next;
+        return block;
+    }
+    if ((size_t)(size_class->end - size_class->cursor) < bytes) refillSizeClass(size_class);
+    void* result = size_class->cursor;
+    size_class->cursor += bytes;
+    return result;
+}
+
+static void poolFree(void* pointer, int index) {
+    FreeBlock* block = (FreeBlock*)pointer;
+    block->next = size_classes[index].free_list;
+    size_classes[index].free_list = block;
+    stats[index].in_use -= sizeClassBytes(index);
+    stats[index].count--;
+}
+
+void initHeap(Heap* heap, bool* error_flag) {
+    heap->bytes_allocated = 0;
+    heap->peak_bytes = 0;
+    heap->limit = 0;
+    heap->limit_exceeded = false;
+    heap->error_flag = error_flag;
+    for (int i = 0; i < VALUE_TYPE_COUNT; i++) {
+        heap->live_objects[i] = 0;
+    }
+}
+
+void useHeap(Heap* heap) {
+    current_heap = heap;
+}
+
+void heapObjectAllocated(ValueType type) {
+    if (current_heap != NULL) current_heap->live_objects[type]++;
+}
+
+void heapObjectFreed(ValueType type) {
+    if (current_heap != NULL && current_heap->live_objects[type] > 0) current_heap->live_objects[type]--;
+}
+
+static void release(void* pointer, size_t oldSize, int old_class) {
+    if (old_class == SIZE_CLASS_COUNT) {
+        stats[SIZE_CLASS_COUNT].in_use -= oldSize;
+        stats[SIZE_CLASS_COUNT].count--;
+        free(pointer);
+    } else if (old_class != -1) {
+        poolFree(pointer, old_class);
+    }
+}
+
+static void chargeHeap(size_t oldSize, size_t newSize) {
+    Heap* heap = current_heap;
+    heap->bytes_allocated += newSize;
+    heap->bytes_allocated -= oldSize;
+    if (heap->bytes_allocated > heap->peak_bytes) heap->peak_bytes = heap->bytes_allocated;
+    // The allocation still succeeds, the VM raises the error before its next instruction.
+    if (heap->limit != 0 && heap->bytes_allocated > heap->limit && !heap->limit_exceeded) {
+        heap->limit_exceeded = true;
+        if (heap->error_flag != NULL) *heap->error_flag = true;
+    }
+}
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
-  if (newSize == 0) {
-    free(pointer);
-    return NULL;
-  }
-
-  void* result = realloc(pointer, newSize);
-  if (result == NULL) exit(1);
-  return result;
+    if (current_heap != NULL) chargeHeap(pointer == NULL ? 0 : oldSize, newSize);
+
+    int old_class = pointer == NULL ? -1 : sizeClassOf(oldSize);
+    int new_class = newSize == 0 ? -1 : sizeClassOf(newSize);
+
+    if (new_class == -1) {
+        release(pointer, oldSize, old_class);
+        return NULL;
+    }
+
+    // Still fits the same block.
+    if (old_class == new_class && new_class != SIZE_CLASS_COUNT) return pointer;
+
+    void* result;
+    if (new_class == SIZE_CLASS_COUNT) {
+        stats[SIZE_CLASS_COUNT].allocated += newSize;
+        stats[SIZE_CLASS_COUNT].in_use += newSize;
+        if (old_class == SIZE_CLASS_COUNT) {
+            // Both large, let realloc grow in place when it can.
+            stats[SIZE_CLASS_COUNT].in_use -= oldSize;
+            result = realloc(pointer, newSize);
+            if (result == NULL) memoryError();
+            return result;
+        }
+        stats[SIZE_CLASS_COUNT].count++;
+        result = malloc(newSize);
+        if (result == NULL) memoryError();
+    } else {
+        result = poolAllocate(new_class);
+    }
+
+    if (old_class != -1) {
+        memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+        release(pointer, oldSize, old_class);
+    }
+    return result;
+}
+
+void freeMemoryPools() {
+    while (slabs != NULL) {
+        Slab* next = slabs->next;
+        free(slabs);
+        slabs = next;
+    }
+    for (int i = 0; i < SIZE_CLASS_COUNT; i++) {
+        size_classes[i].free_list = NULL;
+        size_classes[i].cursor = NULL;
+        size_classes[i].end = NULL;
+        stats[i].in_use = 0;
+        stats[i].count = 0;
+    }
+}
+
+const SizeClassStats* sizeClassStats() {
+    return stats;
 }
 //static void freeObject(Obj* object) {
 //  switch (object->type) {
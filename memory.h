@@ -5,6 +5,7 @@
 #define CJLANG_memory_H
 
 #include "imports.h"
+#include "value.h"
 
 #define ALLOCATE(type, count) \
     (type*)reallocate(NULL, 0, sizeof(type) * (count))
@@ -21,7 +22,39 @@
 #define FREE_ARRAY(type, pointer, oldCount) \
     reallocate(pointer, sizeof(type) * (oldCount), 0)
 
+// Requests up to POOL_MAX_SIZE bytes are served from size-class pools
+// (16, 32, ... 512 bytes), anything larger goes to realloc.
+#define SIZE_CLASS_COUNT 6
+#define POOL_MIN_SIZE 16
+#define POOL_MAX_SIZE (POOL_MIN_SIZE << (SIZE_CLASS_COUNT - 1))
+#define POOL_SLAB_SIZE (64 * 1024)
+
+typedef struct {
+    size_t allocated; // Total bytes handed out over the program's lifetime
+    size_t in_use;    // Bytes currently held by callers
+    size_t count;     // Number of blocks currently held
+} SizeClassStats;
+
+// Per VM memory accounting, every reallocate() call is charged to the heap in use.
+typedef struct {
+    size_t bytes_allocated;
+    size_t peak_bytes;
+    size_t limit; // 0 means no limit
+    bool limit_exceeded;
+    bool* error_flag; // Raised once the limit is exceeded
+    size_t live_objects[VALUE_TYPE_COUNT];
+} Heap;
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+void initHeap(Heap* heap, bool* error_flag);
+void useHeap(Heap* heap);
+void heapObjectAllocated(ValueType type);
+void heapObjectFreed(ValueType type);
+// Releases the calling thread's pools, everything it allocated must have been freed
+void freeMemoryPools();
+// Stats of the calling thread per size class, index SIZE_CLASS_COUNT holds allocations larger than POOL_MAX_SIZE.
+const SizeClassStats* sizeClassStats();
+size_t sizeClassBytes(int size_class);
 //void freeObjects();
 
 #endif // CJLANG_memory_H
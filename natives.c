@@ -0,0 +1,168 @@
+// Module responsible for the builtin native functions.
+
+#include <string.h>
+#include <time.h>
+
+#include "natives.h"
+#include "vm.h"
+#include "object.h"
+#include "vectorOps.h"
+
+static bool typeNative(VM* vm, Value* args, Value* result) {
+    const char* name = strValueType(args[0]);
+    *result = makeStrValue(&vm->strings, name, (int) strlen(name));
+    return true;
+}
+
+static bool lenNative(VM* vm, Value* args, Value* result) {
+    switch (args[0].type) {
+        case OBJECT_STRING_TYPE: *result = MAKE_INTEGER(args[0].content.string_object->length); return true;
+        case OBJECT_LIST_TYPE: *result = MAKE_INTEGER(args[0].content.list_object->count); return true;
+        case OBJECT_ARRAY_TYPE: *result = MAKE_INTEGER(args[0].content.array_object->count); return true;
+        case OBJECT_MAP_TYPE: *result = MAKE_INTEGER(args[0].content.map_object->table.count); return true;
+        default: return nativeError(vm, "Can only use len() on OBJ_STRING, LIST, ARRY & MAP types.");
+    }
+}
+
+static bool appendNative(VM* vm, Value* args, Value* result) {
+    if (args[0].type == OBJECT_ARRAY_TYPE) {
+        if (!IS_NUMERIC(args[1])) return nativeError(vm, "Can only append() numbers to ARRY_TYPE values.");
+        arrayAppend(args[0].content.array_object, AS_DOUBLE(args[1]));
+    } else if (args[0].type == OBJECT_LIST_TYPE) {
+        listAppend(args[0].content.list_object, args[1]);
+    } else {
+        return nativeError(vm, "Can only append() to LIST_TYPE & ARRY_TYPE values.");
+    }
+    *result = MAKE_NONE;
+    return true;
+}
+
+// List of the keys of a map, in the order they were first set
+static bool keysNative(VM* vm, Value* args, Value* result) {
+    if (args[0].type != OBJECT_MAP_TYPE) return nativeError(vm, "keys() takes a MAP_TYPE value.");
+    MapTable* table = &args[0].content.map_object->table;
+    List_Object* keys = newList(vm, table->count);
+    for (int i = 0; i < table->entry_count; i++) {
+        if (table->entries[i].key.type != NONE_TYPE) keys->items[keys->count++] = table->entries[i].key;
+    }
+    *result = MAKE_OBJ_LIST(keys);
+    return true;
+}
+
+// array(n) makes n zeros, array(list) packs the numbers of a list
+static bool arrayNative(VM* vm, Value* args, Value* result) {
+    if (IS_NUMERIC(args[0])) {
+        double count = AS_DOUBLE(args[0]);
+        if (!(count >= 0 && count <= INT32_MAX) || count != (int) count) {
+            return nativeError(vm, "array() takes a whole number of items.");
+        }
+        *result = MAKE_OBJ_ARRAY(newArray(vm, (int) count));
+        return true;
+    }
+    if (args[0].type != OBJECT_LIST_TYPE) return nativeError(vm, "array() takes a number or a LIST_TYPE value.");
+    List_Object* list = args[0].content.list_object;
+    for (int i = 0; i < list->count; i++) {
+        if (!IS_NUMERIC(list->items[i])) return nativeError(vm, "array() can only pack lists of numbers.");
+    }
+    Array_Object* array = newArray(vm, list->count);
+    for (int i = 0; i < list->count; i++) {
+        array->items[i] = AS_DOUBLE(list->items[i]);
+    }
+    *result = MAKE_OBJ_ARRAY(array);
+    return true;
+}
+
+// Bulk operations on arrays, each runs one kernel over all the items
+
+static bool isArray(VM* vm, Value value, const char* message) {
+    if (value.type == OBJECT_ARRAY_TYPE) return true;
+    nativeError(vm, message);
+    return false;
+}
+
+static bool sameLength(VM* vm, Value* args, const char* message) {
+    if (!isArray(vm, args[0], message) || !isArray(vm, args[1], message)) return false;
+    if (args[0].content.array_object->count == args[1].content.array_object->count) return true;
+    nativeError(vm, message);
+    return false;
+}
+
+static bool addNative(VM* vm, Value* args, Value* result) {
+    if (!sameLength(vm, args, "add() takes two ARRY_TYPE values of the same length.")) return false;
+    Array_Object* a = args[0].content.array_object;
+    Array_Object* sum = newArray(vm, a->count);
+    vectorKernels()->add(sum->items, a->items, args[1].content.array_object->items, a->count);
+    *result = MAKE_OBJ_ARRAY(sum);
+    return true;
+}
+
+static bool mulNative(VM* vm, Value* args, Value* result) {
+    if (!sameLength(vm, args, "mul() takes two ARRY_TYPE values of the same length.")) return false;
+    Array_Object* a = args[0].content.array_object;
+    Array_Object* product = newArray(vm, a->count);
+    vectorKernels()->mul(product->items, a->items, args[1].content.array_object->items, a->count);
+    *result = MAKE_OBJ_ARRAY(product);
+    return true;
+}
+
+static bool scaleNative(VM* vm, Value* args, Value* result) {
+    if (!isArray(vm, args[0], "scale() takes an ARRY_TYPE value & a number.")) return false;
+    if (!IS_NUMERIC(args[1])) return nativeError(vm, "scale() takes an ARRY_TYPE value & a number.");
+    Array_Object* a = args[0].content.array_object;
+    Array_Object* scaled = newArray(vm, a->count);
+    vectorKernels()->scale(scaled->items, a->items, AS_DOUBLE(args[1]), a->count);
+    *result = MAKE_OBJ_ARRAY(scaled);
+    return true;
+}
+
+static bool dotNative(VM* vm, Value* args, Value* result) {
+    if (!sameLength(vm, args, "dot() takes two ARRY_TYPE values of the same length.")) return false;
+    Array_Object* a = args[0].content.array_object;
+    *result = MAKE_NUMBER(vectorKernels()->dot(a->items, args[1].content.array_object->items, a->count));
+    return true;
+}
+
+static bool sumNative(VM* vm, Value* args, Value* result) {
+    if (!isArray(vm, args[0], "sum() takes an ARRY_TYPE value.")) return false;
+    Array_Object* a = args[0].content.array_object;
+    *result = MAKE_NUMBER(vectorKernels()->sum(a->items, a->count));
+    return true;
+}
+
+static bool minNative(VM* vm, Value* args, Value* result) {
+    if (!isArray(vm, args[0], "min() takes an ARRY_TYPE value.")) return false;
+    Array_Object* a = args[0].content.array_object;
+    if (a->count == 0) return nativeError(vm, "min() of an empty array.");
+    *result = MAKE_NUMBER(vectorKernels()->min(a->items, a->count));
+    return true;
+}
+
+static bool maxNative(VM* vm, Value* args, Value* result) {
+    if (!isArray(vm, args[0], "max() takes an ARRY_TYPE value.")) return false;
+    Array_Object* a = args[0].content.array_object;
+    if (a->count == 0) return nativeError(vm, "max() of an empty array.");
+    *result = MAKE_NUMBER(vectorKernels()->max(a->items, a->count));
+    return true;
+}
+
+static bool timeNative(VM* vm, Value* args, Value* result) {
+    *result = MAKE_INTEGER((int64_t) time(NULL));
+    return true;
+}
+
+void defineBuiltins(Runtime* runtime) {
+    defineNative(runtime, "type", 1, true, typeNative);
+    defineNative(runtime, "len", 1, true, lenNative);
+    defineNative(runtime, "time", 0, false, timeNative);
+    defineNative(runtime, "append", 2, false, appendNative);
+    // Natives making a new array are impure, a memoized call would hand out the same one
+    defineNative(runtime, "keys", 1, false, keysNative);
+    defineNative(runtime, "array", 1, false, arrayNative);
+    defineNative(runtime, "add", 2, false, addNative);
+    defineNative(runtime, "mul", 2, false, mulNative);
+    defineNative(runtime, "scale", 2, false, scaleNative);
+    defineNative(runtime, "dot", 2, true, dotNative);
+    defineNative(runtime, "sum", 1, true, sumNative);
+    defineNative(runtime, "min", 1, true, minNative);
+    defineNative(runtime, "max", 1, true, maxNative);
+}
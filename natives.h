@@ -0,0 +1,10 @@
+// Module responsible for the builtin native functions.
+
+#ifndef CJLANG_NATIVES_H
+#define CJLANG_NATIVES_H
+
+#include "runtime.h"
+
+void defineBuiltins(Runtime* runtime);
+
+#endif //CJLANG_NATIVES_H
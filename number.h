@@ -0,0 +1,91 @@
+// Module responsible for arithmetic on number values.
+// Shared by the VM & the compiler folding constant expressions, so both agree on every result.
+
+#ifndef CJLANG_NUMBER_H
+#define CJLANG_NUMBER_H
+
+#include <math.h>
+
+#include "value.h"
+
+// Arithmetic on two numbers. Integers stay integers unless the result overflows or has a fraction,
+// anything else is computed on doubles.
+#define INTEGER_ARITHMETIC(name, builtin, op) \
+    static inline Value name(Value a, Value b) { \
+        int64_t result; \
+        if (a.type == INTEGER_TYPE && b.type == INTEGER_TYPE && \
+            !builtin(a.content.integer_value, b.content.integer_value, &result)) { \
+            return MAKE_INTEGER(result); \
+        } \
+        return MAKE_NUMBER(AS_DOUBLE(a) op AS_DOUBLE(b)); \
+    }
+
+INTEGER_ARITHMETIC(addNumbers, __builtin_add_overflow, +)
+INTEGER_ARITHMETIC(subtractNumbers, __builtin_sub_overflow, -)
+INTEGER_ARITHMETIC(multiplyNumbers, __builtin_mul_overflow, *)
+
+static inline Value divideNumbers(Value a, Value b) {
+    if (a.type == INTEGER_TYPE && b.type == INTEGER_TYPE) {
+        int64_t x = a.content.integer_value, y = b.content.integer_value;
+        if (y != 0 && !(x == INT64_MIN && y == -1) && x % y == 0) return MAKE_INTEGER(x / y);
+    }
+    return MAKE_NUMBER(AS_DOUBLE(a) / AS_DOUBLE(b));
+}
+
+// C style remainder, it takes the sign of the dividend.
+static inline Value modNumbers(Value a, Value b) {
+    if (a.type == INTEGER_TYPE && b.type == INTEGER_TYPE && b.content.integer_value != 0) {
+        // INT64_MIN % -1 overflows
+        if (b.content.integer_value == -1) return MAKE_INTEGER(0);
+        return MAKE_INTEGER(a.content.integer_value % b.content.integer_value);
+    }
+    return MAKE_NUMBER(fmod(AS_DOUBLE(a), AS_DOUBLE(b)));
+}
+
+// Exponentiation by squaring for integral exponents, pow() for fractional ones.
+static inline Value powerNumbers(Value base, Value exp) {
+    double exp_value = AS_DOUBLE(exp);
+    if (exp.type != INTEGER_TYPE && (exp_value != trunc(exp_value) || fabs(exp_value) >= 0x1p63)) {
+        return MAKE_NUMBER(pow(AS_DOUBLE(base), exp_value));
+    }
+    int64_t n = exp.type == INTEGER_TYPE ? exp.content.integer_value : (int64_t) exp_value;
+    uint64_t remaining = n < 0 ? -(uint64_t) n : (uint64_t) n;
+    if (base.type == INTEGER_TYPE && n >= 0) {
+        int64_t result = 1, square = base.content.integer_value;
+        bool overflow = false;
+        while (remaining > 0 && !overflow) {
+            if (remaining & 1) overflow = __builtin_mul_overflow(result, square, &result);
+            remaining >>= 1;
+            if (remaining > 0 && !overflow) overflow = __builtin_mul_overflow(square, square, &square);
+        }
+        if (!overflow) return MAKE_INTEGER(result);
+        remaining = (uint64_t) n;
+    }
+    double result = 1, square = AS_DOUBLE(base);
+    while (remaining > 0) {
+        if (remaining & 1) result *= square;
+        remaining >>= 1;
+        square *= square;
+    }
+    return MAKE_NUMBER(n < 0 ? 1 / result : result);
+}
+
+#define NUMBER_COMPARISON(name, op) \
+    static inline Value name(Value a, Value b) { \
+        if (a.type == INTEGER_TYPE && b.type == INTEGER_TYPE) { \
+            return MAKE_BOOL(a.content.integer_value op b.content.integer_value); \
+        } \
+        return MAKE_BOOL(AS_DOUBLE(a) op AS_DOUBLE(b)); \
+    }
+
+NUMBER_COMPARISON(greaterNumbers, >)
+NUMBER_COMPARISON(lessNumbers, <)
+NUMBER_COMPARISON(equalNumbers, ==)
+
+static inline Value negateNumber(Value v) {
+    // -INT64_MIN doesn't fit an integer
+    if (v.type == INTEGER_TYPE && v.content.integer_value != INT64_MIN) return MAKE_INTEGER(-v.content.integer_value);
+    return MAKE_NUMBER(-AS_DOUBLE(v));
+}
+
+#endif //CJLANG_NUMBER_H
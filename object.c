@@ -4,6 +4,7 @@
 #include <string.h>
 
 #include "memory.h"
+#include "object.h"
 
 char* copyString(const char* chars, int length) {
     char* heapChars = ALLOCATE(char, length + 1);
@@ -12,8 +13,58 @@ char* copyString(const char* chars, int length) {
     return heapChars;
 }
 
+void listAppend(List_Object* list, Value value) {
+    if (list->count >= list->capacity) {
+        int new_capacity = GROW_CAPACITY(list->capacity);
+        list->items = GROW_ARRAY(Value, list->items, list->capacity, new_capacity);
+        list->capacity = new_capacity;
+    }
+    list->items[list->count++] = value;
+}
+
+void arrayAppend(Array_Object* array, double value) {
+    if (array->count >= array->capacity) {
+        int new_capacity = GROW_CAPACITY(array->capacity);
+        array->items = GROW_ARRAY(double, array->items, array->capacity, new_capacity);
+        array->capacity = new_capacity;
+    }
+    array->items[array->count++] = value;
+}
+
+void freeObject(Object* object) {
+    switch (object->type) {
+        case OBJECT_LIST_TYPE: {
+            List_Object* list = (List_Object*) object;
+            FREE_ARRAY(Value, list->items, list->capacity);
+            FREE(List_Object, list);
+            heapObjectFreed(OBJECT_LIST_TYPE);
+            break;
+        }
+        case OBJECT_MAP_TYPE: {
+            Map_Object* map = (Map_Object*) object;
+            freeMapTable(&map->table);
+            FREE(Map_Object, map);
+            heapObjectFreed(OBJECT_MAP_TYPE);
+            break;
+        }
+        case OBJECT_ARRAY_TYPE: {
+            Array_Object* array = (Array_Object*) object;
+            FREE_ARRAY(double, array->items, array->capacity);
+            FREE(Array_Object, array);
+            heapObjectFreed(OBJECT_ARRAY_TYPE);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
 uint32_t hashString(const char* key, int length) {
-    uint32_t hash = 2166136261u;
+    return hashContinue(2166136261u, key, length);
+}
+
+// Continues an FNV-1a hash over more bytes, hashing a + b equals hashContinue(hash(a), b).
+uint32_t hashContinue(uint32_t hash, const char* key, int length) {
     for (int i = 0; i < length; i++) {
         hash ^= (uint8_t)key[i];
         hash *= 16777619;
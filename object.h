@@ -6,6 +6,7 @@
 #define CJLANG_OBJECT_H
 
 #include "value.h"
+#include "hashTable.h"
 
 struct String_Object {
     int length;
@@ -13,7 +14,40 @@ struct String_Object {
     uint32_t hash;
 };
 
+// Header of the objects a VM allocates one by one, linked so the collector can sweep them.
+// Strings are interned in arenas instead & live as long as their string set.
+typedef struct Object {
+    ValueType type;
+    bool marked;
+    struct Object* next;
+} Object;
+
+struct List_Object {
+    Object object;
+    int count;
+    int capacity;
+    Value* items;
+};
+
+struct Array_Object {
+    Object object;
+    int count;
+    int capacity;
+    double* items;
+};
+
+struct Map_Object {
+    Object object;
+    MapTable table;
+};
+
+// Appends in amortized constant time, the items stay contiguous
+void listAppend(List_Object* list, Value value);
+void arrayAppend(Array_Object* array, double value);
+void freeObject(Object* object);
+
 char* copyString(const char* chars, int length);
 uint32_t hashString(const char* key, int length);
+uint32_t hashContinue(uint32_t hash, const char* key, int length);
 
 #endif //CJLANG_OBJECT_H
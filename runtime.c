@@ -0,0 +1,43 @@
+// Module responsible for runtime instances.
+
+#include <string.h>
+
+#include "runtime.h"
+#include "memory.h"
+#include "natives.h"
+
+void initRuntime(Runtime* runtime) {
+    initStrTable(&runtime->strings);
+    runtime->natives = NULL;
+    runtime->native_count = 0;
+    runtime->native_capacity = 0;
+    initTable(&runtime->native_names);
+    defineBuiltins(runtime);
+}
+
+void freeRuntime(Runtime* runtime) {
+    freeTable(&runtime->native_names);
+    FREE_ARRAY(Native, runtime->natives, runtime->native_capacity);
+    freeStrTable(&runtime->strings);
+}
+
+bool defineNative(Runtime* runtime, const char* name, int arity, bool pure, NativeFn function) {
+    Value name_value = makeStrValue(&runtime->strings, name, (int) strlen(name));
+    Value existing;
+    if (runtime->native_count >= NATIVE_LIMIT || tableGet(&runtime->native_names, name_value, &existing)) {
+        return false;
+    }
+    if (runtime->native_count >= runtime->native_capacity) {
+        int new_capacity = GROW_CAPACITY(runtime->native_capacity);
+        runtime->natives = GROW_ARRAY(Native, runtime->natives, runtime->native_capacity, new_capacity);
+        runtime->native_capacity = new_capacity;
+    }
+    Native* native = &runtime->natives[runtime->native_count];
+    native->name = name_value;
+    native->function = function;
+    native->arity = arity;
+    native->pure = pure;
+    tableSet(&runtime->native_names, name_value, MAKE_NUMBER(runtime->native_count));
+    runtime->native_count++;
+    return true;
+}
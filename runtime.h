@@ -0,0 +1,46 @@
+// Module responsible for runtime instances.
+// A runtime owns what the programs compiled in it & the VMs running them share, separate runtimes share nothing.
+
+#ifndef CJLANG_RUNTIME_H
+#define CJLANG_RUNTIME_H
+
+#include "makeString.h"
+#include "hashTable.h"
+
+// Natives are referred to by a one byte index
+#define NATIVE_LIMIT 256
+
+struct VM;
+
+// C function callable from scripts. Its arguments are read in place on the VM's stack, as many as its arity.
+// Returns false once it reported an error with nativeError().
+typedef bool (*NativeFn)(struct VM* vm, Value* args, Value* result);
+
+typedef struct {
+    Value name;
+    NativeFn function;
+    int arity;
+    // No side effects, the result only depends on the arguments
+    bool pure;
+} Native;
+
+typedef struct {
+    // Strings interned by the compiler & the VMs, compared by pointer
+    StringSet strings;
+    // Native functions, indexed by the operand of OP_CALL_NATIVE
+    Native* natives;
+    int native_count;
+    int native_capacity;
+    // Native name -> index
+    Table native_names;
+} Runtime;
+
+// The builtin natives of natives.c are defined right away
+void initRuntime(Runtime* runtime);
+// Releases the strings of every program compiled in the runtime, free its VMs first
+void freeRuntime(Runtime* runtime);
+// Makes function callable as name from the scripts compiled afterwards.
+// Returns false if a native already has that name, or if there are too many.
+bool defineNative(Runtime* runtime, const char* name, int arity, bool pure, NativeFn function);
+
+#endif //CJLANG_RUNTIME_H
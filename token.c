@@ -86,7 +86,14 @@ static TokenType checkKeyword(Tokenizer* tokenizer, int start, int length,
 static TokenType identifierType(Tokenizer* tokenizer) {
     switch (tokenizer->start[0]) {
         case 'a': return checkKeyword(tokenizer, 1, 2, "nd", AND_T);
-        case 'd': return checkKeyword(tokenizer, 1, 2, "ef", DEF_T);
+        case 'd':
+            if (tokenizer->current_char - tokenizer->start > 2 && tokenizer->start[1] == 'e') {
+                switch (tokenizer->start[2]) {
+                    case 'f': return checkKeyword(tokenizer, 3, 0, "", DEF_T);
+                    case 'l': return checkKeyword(tokenizer, 3, 0, "", DEL_T);
+                }
+            }
+            break;
         case 'e': return checkKeyword(tokenizer, 1, 3, "lse", ELSE_T);
         case 'F': return checkKeyword(tokenizer, 1, 4, "alse", FALSE_T);
         case 'f':
@@ -98,27 +105,19 @@ static TokenType identifierType(Tokenizer* tokenizer) {
             }
             break;
         case 'G': return checkKeyword(tokenizer, 1, 5, "lobal", GLOBAL_T);
-        case 'i': return checkKeyword(tokenizer, 1, 1, "f", IF_T);
-        case 'N': return checkKeyword(tokenizer, 1, 3, "one", NONE_T);
-        case 'o': return checkKeyword(tokenizer, 1, 1, "r", OR_T);
-        case 'p': return checkKeyword(tokenizer, 1, 4, "rint", PRINT_T);
-        case 'r': return checkKeyword(tokenizer, 1, 5, "eturn", RETURN_T);
-        case 'l':
+        case 'i':
             if (tokenizer->current_char - tokenizer->start > 1) {
                 switch (tokenizer->start[1]) {
-                    case 'p': return checkKeyword(tokenizer, 2, 4, "rint", PRINTLN_T);
-                    case 'e': return checkKeyword(tokenizer, 2, 1, "n", LEN_T);
-                }
-            }
-            break;
-        case 't':
-            if (tokenizer->current_char - tokenizer->start > 1) {
-                switch (tokenizer->start[1]) {
-                    case 'y': return checkKeyword(tokenizer, 2, 2, "pe", TYPE_T);
-                    case 'i': return checkKeyword(tokenizer, 2, 2, "me", TIME_T);
+                    case 'f': return checkKeyword(tokenizer, 2, 0, "", IF_T);
+                    case 'n': return checkKeyword(tokenizer, 2, 0, "", IN_T);
                 }
             }
             break;
+        case 'N': return checkKeyword(tokenizer, 1, 3, "one", NONE_T);
+        case 'o': return checkKeyword(tokenizer, 1, 1, "r", OR_T);
+        case 'p': return checkKeyword(tokenizer, 1, 4, "rint", PRINT_T);
+        case 'r': return checkKeyword(tokenizer, 1, 5, "eturn", RETURN_T);
+        case 'l': return checkKeyword(tokenizer, 1, 5, "print", PRINTLN_T);
         case 'T': return checkKeyword(tokenizer, 1, 3, "rue", TRUE_T);
         case 'v': return checkKeyword(tokenizer, 1, 2, "ar", VAR_T);
         case 'w': return checkKeyword(tokenizer, 1, 4, "hile", WHILE_T);
@@ -131,6 +130,11 @@ static Token identifier(Tokenizer* tokenizer) {
     return makeToken(tokenizer, identifierType(tokenizer));
 }
 
+static Token annotation(Tokenizer* tokenizer) {
+    while (isAlpha(peekNextChar(tokenizer)) || isDigit(peekNextChar(tokenizer))) getNextChar(tokenizer);
+    return makeToken(tokenizer, checkKeyword(tokenizer, 1, 4, "memo", MEMO_T) == MEMO_T ? MEMO_T : ERROR_T);
+}
+
 static Token number(Tokenizer* tokenizer) {
     while (isDigit(peekNextChar(tokenizer))) getNextChar(tokenizer);
 
@@ -176,7 +180,10 @@ Token nextToken(Tokenizer* tokenizer) {
         case ')': return makeToken(tokenizer,RIGHT_PAREN_T);
         case '{': return makeToken(tokenizer,LEFT_BRACE_T);
         case '}': return makeToken(tokenizer,RIGHT_BRACE_T);
+        case '[': return makeToken(tokenizer,LEFT_BRACKET_T);
+        case ']': return makeToken(tokenizer,RIGHT_BRACKET_T);
         case ';': return makeToken(tokenizer,SEMICOLON_T);
+        case ':': return makeToken(tokenizer,COLON_T);
         case ',': return makeToken(tokenizer,COMMA_T);
         case '.': return makeToken(tokenizer,DOT_T);
         case '-':
@@ -200,6 +207,7 @@ Token nextToken(Tokenizer* tokenizer) {
         case '%':
             return makeToken(tokenizer,match(tokenizer, '=') ? MOD_EQUAL_T : MOD_T);
         case '"': return string(tokenizer);
+        case '@': return annotation(tokenizer);
     }
 
     return makeToken(tokenizer, ERROR_T);
@@ -11,8 +11,9 @@ typedef enum {
     // Single-character tokens.
     LEFT_PAREN_T, RIGHT_PAREN_T,
     LEFT_BRACE_T, RIGHT_BRACE_T,
+    LEFT_BRACKET_T, RIGHT_BRACKET_T,
     COMMA_T, DOT_T, MINUS_T, MINUS_EQUAL_T, PLUS_T, PLUS_EQUAL_T,
-    SEMICOLON_T, SLASH_T, SLASH_EQUAL_T, STAR_T, STAR_EQUAL_T, CARET_T, CARET_EQUAL_T,
+    COLON_T, SEMICOLON_T, SLASH_T, SLASH_EQUAL_T, STAR_T, STAR_EQUAL_T, CARET_T, CARET_EQUAL_T,
     MOD_T, MOD_EQUAL_T,
     // One or two character tokens.
     BANG_T, BANG_EQUAL_T,
@@ -23,10 +24,12 @@ typedef enum {
     IDENTIFIER_T, STRING_T, NUMBER_T,
     // Keywords.
     AND_T, ELSE_T, FALSE_T,
-    FOR_T, FUN_T, IF_T, NONE_T, OR_T, LEN_T,
+    FOR_T, FUN_T, IF_T, NONE_T, OR_T,
     PRINT_T, PRINTLN_T, RETURN_T,
-    TRUE_T, TYPE_T, VAR_T, WHILE_T,
-    DEF_T, TIME_T,
+    TRUE_T, VAR_T, WHILE_T,
+    DEF_T, DEL_T, IN_T,
+    // Annotations.
+    MEMO_T,
 
     ERROR_T, EOF_T
 } TokenType;
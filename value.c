@@ -33,6 +33,62 @@ void resetValueArray(ValueArray* array){
     initValueArray(array);
 }
 
+// Prints the items of a list or map, ones nested deeper than this are elided so cycles terminate.
+#define PRINT_DEPTH_LIMIT 8
+
+static void printNested(Value value, int depth);
+
+static void printList(List_Object* list, int depth) {
+    if (depth >= PRINT_DEPTH_LIMIT) {
+        printf("[...]");
+        return;
+    }
+    printf("[");
+    for (int i = 0; i < list->count; i++) {
+        if (i > 0) printf(", ");
+        printNested(list->items[i], depth + 1);
+    }
+    printf("]");
+}
+
+static void printMap(Map_Object* map, int depth) {
+    if (depth >= PRINT_DEPTH_LIMIT) {
+        printf("{...}");
+        return;
+    }
+    printf("{");
+    bool first = true;
+    for (int i = 0; i < map->table.entry_count; i++) {
+        MapEntry* entry = &map->table.entries[i];
+        if (entry->key.type == NONE_TYPE) continue;
+        if (!first) printf(", ");
+        first = false;
+        printValue(entry->key);
+        printf(": ");
+        printNested(entry->value, depth + 1);
+    }
+    printf("}");
+}
+
+static void printArray(Array_Object* array) {
+    printf("array[");
+    for (int i = 0; i < array->count; i++) {
+        if (i > 0) printf(", ");
+        printf("%g", array->items[i]);
+    }
+    printf("]");
+}
+
+static void printNested(Value value, int depth) {
+    if (value.type == OBJECT_LIST_TYPE) {
+        printList(value.content.list_object, depth);
+    } else if (value.type == OBJECT_MAP_TYPE) {
+        printMap(value.content.map_object, depth);
+    } else {
+        printValue(value);
+    }
+}
+
 void printValue(Value value){
     switch (value.type) {
         case NONE_TYPE: printf("None"); return;
@@ -45,11 +101,15 @@ void printValue(Value value){
             return;
         }
         case NUMBER_TYPE: printf("%g", value.content.number_value); return;
+        case INTEGER_TYPE: printf("%lld", (long long) value.content.integer_value); return;
         case OBJECT_STRING_TYPE: {
             char* string = value.content.string_object->cString;
             printf("%s", string);
             return;
         }
+        case OBJECT_LIST_TYPE: printList(value.content.list_object, 0); return;
+        case OBJECT_ARRAY_TYPE: printArray(value.content.array_object); return;
+        case OBJECT_MAP_TYPE: printMap(value.content.map_object, 0); return;
         default: break;
     }
     printf("Unknown Value Type");
@@ -59,8 +119,12 @@ char* strValueType(Value value) {
     switch (value.type) {
         case NONE_TYPE: return "NONE_TYPE";
         case BOOL_TYPE: return "BOOL_TYPE";
-        case NUMBER_TYPE: return "NMBR_TYPE";
+        case NUMBER_TYPE:
+        case INTEGER_TYPE: return "NMBR_TYPE";
         case OBJECT_STRING_TYPE: return "OSTR_TYPE";
+        case OBJECT_LIST_TYPE: return "LIST_TYPE";
+        case OBJECT_ARRAY_TYPE: return "ARRY_TYPE";
+        case OBJECT_MAP_TYPE: return "MAP_TYPE";
         default: return "_UNKNOWN_";
     }
 }
@@ -78,6 +142,7 @@ void debugPrintValue(Value value) {
             return;
         }
         case NUMBER_TYPE: printf("(NUM_T)"); printf("%g", value.content.number_value); return;
+        case INTEGER_TYPE: printf("(INT_T)"); printf("%lld", (long long) value.content.integer_value); return;
         case OBJECT_STRING_TYPE: {
             printf("(STR_T)");
             char* string = value.content.string_object->cString;
@@ -88,6 +153,9 @@ void debugPrintValue(Value value) {
             }
             return;
         }
+        case OBJECT_LIST_TYPE: printf("(LIST_T)%d items", value.content.list_object->count); return;
+        case OBJECT_ARRAY_TYPE: printf("(ARRY_T)%d items", value.content.array_object->count); return;
+        case OBJECT_MAP_TYPE: printf("(MAP_T)%d entries", value.content.map_object->table.count); return;
         default: break;
     }
     printf("Unknown Value Type");
@@ -9,12 +9,24 @@
 
 //typedef struct Object Object;
 typedef struct String_Object String_Object;
+typedef struct List_Object List_Object;
+typedef struct Array_Object Array_Object;
+typedef struct Map_Object Map_Object;
 
 typedef enum {
     NONE_TYPE,
     NUMBER_TYPE,
+    // Numbers without a fractional part, computed on int64 until they overflow
+    INTEGER_TYPE,
     BOOL_TYPE,
     OBJECT_STRING_TYPE,
+    // Mutable array of values, owned by the VM that created it
+    OBJECT_LIST_TYPE,
+    // Packed doubles without a type per item, for the bulk numeric operations
+    OBJECT_ARRAY_TYPE,
+    // Values keyed by numbers, bools & strings, in insertion order
+    OBJECT_MAP_TYPE,
+    VALUE_TYPE_COUNT,
 } ValueType;
 
 typedef struct {
@@ -22,7 +34,11 @@ typedef struct {
     union {
         bool bool_value;
         double number_value;
+        int64_t integer_value;
         String_Object* string_object;
+        List_Object* list_object;
+        Array_Object* array_object;
+        Map_Object* map_object;
     } content;
 } Value;
 
@@ -38,9 +54,17 @@ void resetValueArray(ValueArray* array);
 
 #define MAKE_NONE ((Value){NONE_TYPE, {.bool_value = false}})
 #define MAKE_NUMBER(value) ((Value){NUMBER_TYPE, {.number_value = value}})
+#define MAKE_INTEGER(value) ((Value){INTEGER_TYPE, {.integer_value = value}})
 #define MAKE_BOOL(value) ((Value){BOOL_TYPE, {.bool_value = value}})
 
 #define MAKE_OBJ_STRING(obj_ptr) ((Value){OBJECT_STRING_TYPE, {.string_object = obj_ptr}})
+#define MAKE_OBJ_LIST(obj_ptr) ((Value){OBJECT_LIST_TYPE, {.list_object = obj_ptr}})
+#define MAKE_OBJ_ARRAY(obj_ptr) ((Value){OBJECT_ARRAY_TYPE, {.array_object = obj_ptr}})
+#define MAKE_OBJ_MAP(obj_ptr) ((Value){OBJECT_MAP_TYPE, {.map_object = obj_ptr}})
+
+// Integers & doubles are both numbers in the language
+#define IS_NUMERIC(value) ((value).type == NUMBER_TYPE || (value).type == INTEGER_TYPE)
+#define AS_DOUBLE(value) ((value).type == INTEGER_TYPE ? (double)(value).content.integer_value : (value).content.number_value)
 
 void printValue(Value value);
 
@@ -0,0 +1,216 @@
+// Module responsible for the bulk operations on packed double arrays.
+
+#include "vectorOps.h"
+
+#if !defined(VECTOR_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_X86
+#include <immintrin.h>
+#endif
+
+static void addScalar(double* dst, const double* a, const double* b, int count) {
+    for (int i = 0; i < count; i++) dst[i] = a[i] + b[i];
+}
+
+static void mulScalar(double* dst, const double* a, const double* b, int count) {
+    for (int i = 0; i < count; i++) dst[i] = a[i] * b[i];
+}
+
+static void scaleScalar(double* dst, const double* a, double factor, int count) {
+    for (int i = 0; i < count; i++) dst[i] = a[i] * factor;
+}
+
+static double sumScalar(const double* a, int count) {
+    double sum = 0;
+    for (int i = 0; i < count; i++) sum += a[i];
+    return sum;
+}
+
+static double dotScalar(const double* a, const double* b, int count) {
+    double sum = 0;
+    for (int i = 0; i < count; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+static double minScalar(const double* a, int count) {
+    double min = a[0];
+    for (int i = 1; i < count; i++) {
+        if (a[i] < min) min = a[i];
+    }
+    return min;
+}
+
+static double maxScalar(const double* a, int count) {
+    double max = a[0];
+    for (int i = 1; i < count; i++) {
+        if (a[i] > max) max = a[i];
+    }
+    return max;
+}
+
+static const VectorKernels scalar_kernels = {
+        "scalar", addScalar, mulScalar, scaleScalar, sumScalar, dotScalar, minScalar, maxScalar,
+};
+
+#ifdef VECTOR_X86
+
+// Every lane of the min & max accumulators starts at the first item, min_pd(item, acc) keeps acc when the item is NaN:
+// the same result as the scalar kernels.
+
+__attribute__((target("sse2")))
+static void addSSE2(double* dst, const double* a, const double* b, int count) {
+    int i = 0;
+    for (; i + 2 <= count; i += 2) _mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    addScalar(dst + i, a + i, b + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static void mulSSE2(double* dst, const double* a, const double* b, int count) {
+    int i = 0;
+    for (; i + 2 <= count; i += 2) _mm_storeu_pd(dst + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    mulScalar(dst + i, a + i, b + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static void scaleSSE2(double* dst, const double* a, double factor, int count) {
+    __m128d factors = _mm_set1_pd(factor);
+    int i = 0;
+    for (; i + 2 <= count; i += 2) _mm_storeu_pd(dst + i, _mm_mul_pd(_mm_loadu_pd(a + i), factors));
+    scaleScalar(dst + i, a + i, factor, count - i);
+}
+
+__attribute__((target("sse2")))
+static double sumLanesSSE2(__m128d lanes) {
+    double parts[2];
+    _mm_storeu_pd(parts, lanes);
+    return parts[0] + parts[1];
+}
+
+__attribute__((target("sse2")))
+static double sumSSE2(const double* a, int count) {
+    __m128d sum = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 2 <= count; i += 2) sum = _mm_add_pd(sum, _mm_loadu_pd(a + i));
+    return sumLanesSSE2(sum) + sumScalar(a + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static double dotSSE2(const double* a, const double* b, int count) {
+    __m128d sum = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 2 <= count; i += 2) sum = _mm_add_pd(sum, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    return sumLanesSSE2(sum) + dotScalar(a + i, b + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static double minSSE2(const double* a, int count) {
+    __m128d min = _mm_set1_pd(a[0]);
+    int i = 0;
+    for (; i + 2 <= count; i += 2) min = _mm_min_pd(_mm_loadu_pd(a + i), min);
+    double lanes[3];
+    _mm_storeu_pd(lanes, min);
+    lanes[2] = i < count ? minScalar(a + i, count - i) : lanes[0];
+    return minScalar(lanes, 3);
+}
+
+__attribute__((target("sse2")))
+static double maxSSE2(const double* a, int count) {
+    __m128d max = _mm_set1_pd(a[0]);
+    int i = 0;
+    for (; i + 2 <= count; i += 2) max = _mm_max_pd(_mm_loadu_pd(a + i), max);
+    double lanes[3];
+    _mm_storeu_pd(lanes, max);
+    lanes[2] = i < count ? maxScalar(a + i, count - i) : lanes[0];
+    return maxScalar(lanes, 3);
+}
+
+static const VectorKernels sse2_kernels = {
+        "sse2", addSSE2, mulSSE2, scaleSSE2, sumSSE2, dotSSE2, minSSE2, maxSSE2,
+};
+
+__attribute__((target("avx2")))
+static void addAVX2(double* dst, const double* a, const double* b, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    addScalar(dst + i, a + i, b + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void mulAVX2(double* dst, const double* a, const double* b, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    mulScalar(dst + i, a + i, b + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void scaleAVX2(double* dst, const double* a, double factor, int count) {
+    __m256d factors = _mm256_set1_pd(factor);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), factors));
+    scaleScalar(dst + i, a + i, factor, count - i);
+}
+
+__attribute__((target("avx2")))
+static double sumLanesAVX2(__m256d lanes) {
+    double parts[4];
+    _mm256_storeu_pd(parts, lanes);
+    return (parts[0] + parts[1]) + (parts[2] + parts[3]);
+}
+
+__attribute__((target("avx2")))
+static double sumAVX2(const double* a, int count) {
+    __m256d sum = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= count; i += 4) sum = _mm256_add_pd(sum, _mm256_loadu_pd(a + i));
+    return sumLanesAVX2(sum) + sumScalar(a + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static double dotAVX2(const double* a, const double* b, int count) {
+    __m256d sum = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    return sumLanesAVX2(sum) + dotScalar(a + i, b + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static double minAVX2(const double* a, int count) {
+    __m256d min = _mm256_set1_pd(a[0]);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) min = _mm256_min_pd(_mm256_loadu_pd(a + i), min);
+    double lanes[5];
+    _mm256_storeu_pd(lanes, min);
+    lanes[4] = i < count ? minScalar(a + i, count - i) : lanes[0];
+    return minScalar(lanes, 5);
+}
+
+__attribute__((target("avx2")))
+static double maxAVX2(const double* a, int count) {
+    __m256d max = _mm256_set1_pd(a[0]);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) max = _mm256_max_pd(_mm256_loadu_pd(a + i), max);
+    double lanes[5];
+    _mm256_storeu_pd(lanes, max);
+    lanes[4] = i < count ? maxScalar(a + i, count - i) : lanes[0];
+    return maxScalar(lanes, 5);
+}
+
+static const VectorKernels avx2_kernels = {
+        "avx2", addAVX2, mulAVX2, scaleAVX2, sumAVX2, dotAVX2, minAVX2, maxAVX2,
+};
+
+#endif
+
+const VectorKernels* vectorKernels(void) {
+#ifdef VECTOR_X86
+    // Reads the CPUID bits libgcc cached at startup, cheap enough to ask on every bulk operation
+    if (__builtin_cpu_supports("avx2")) return &avx2_kernels;
+    if (__builtin_cpu_supports("sse2")) return &sse2_kernels;
+#endif
+    return &scalar_kernels;
+}
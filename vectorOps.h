@@ -0,0 +1,26 @@
+// Module responsible for the bulk operations on packed double arrays.
+// Each operation has a scalar kernel & SSE2/AVX2 ones, the widest the CPU supports is picked at runtime.
+
+#ifndef CJLANG_VECTOROPS_H
+#define CJLANG_VECTOROPS_H
+
+#include "imports.h"
+
+typedef struct {
+    const char* name;
+    // dst may be one of the operands
+    void (*add)(double* dst, const double* a, const double* b, int count);
+    void (*mul)(double* dst, const double* a, const double* b, int count);
+    void (*scale)(double* dst, const double* a, double factor, int count);
+    // Vector kernels add in several lanes, their sums may round differently than adding one item at a time
+    double (*sum)(const double* a, int count);
+    double (*dot)(const double* a, const double* b, int count);
+    // Need at least one item, a NaN first item makes the result NaN & later ones are skipped
+    double (*min)(const double* a, int count);
+    double (*max)(const double* a, int count);
+} VectorKernels;
+
+// Kernels for the current CPU, building with VECTOR_NO_SIMD always gives the scalar ones
+const VectorKernels* vectorKernels(void);
+
+#endif //CJLANG_VECTOROPS_H
@@ -0,0 +1,450 @@
+// Module responsible for verifying bytecode once before it runs.
+
+#include <stdio.h>
+
+#include "verifier.h"
+#include "memory.h"
+#include "hashTable.h"
+
+#define TOP_LEVEL (-1)
+#define UNVISITED (-2)
+
+// Number of operand stack values each instruction consumes.
+static const uint8_t stack_inputs[OP_CODE_COUNT] = {
+        [OP_POP] = 1,
+        [OP_SET_GLOBAL] = 1,
+        [OP_SET_VAR] = 1,
+        [OP_GET_INDEX] = 2,
+        [OP_SET_INDEX] = 3,
+        [OP_DELETE_KEY] = 2,
+        [OP_HAS_KEY] = 2,
+        [OP_EQUAL] = 2,
+        [OP_GREATER] = 2,
+        [OP_LESS] = 2,
+        [OP_ADD] = 2,
+        [OP_SUBTRACT] = 2,
+        [OP_MULTIPLY] = 2,
+        [OP_DIVIDE] = 2,
+        [OP_EXPONENT] = 2,
+        [OP_MOD] = 2,
+        [OP_ADD_NUM] = 2,
+        [OP_SUBTRACT_NUM] = 2,
+        [OP_MULTIPLY_NUM] = 2,
+        [OP_DIVIDE_NUM] = 2,
+        [OP_GREATER_NUM] = 2,
+        [OP_LESS_NUM] = 2,
+        [OP_ADD_NUM_GUARDED] = 2,
+        [OP_ADD_STR_GUARDED] = 2,
+        [OP_SUBTRACT_NUM_GUARDED] = 2,
+        [OP_MULTIPLY_NUM_GUARDED] = 2,
+        [OP_DIVIDE_NUM_GUARDED] = 2,
+        [OP_GREATER_NUM_GUARDED] = 2,
+        [OP_LESS_NUM_GUARDED] = 2,
+        [OP_NOT] = 1,
+        [OP_NEGATE] = 1,
+        [OP_PRINT] = 1,
+        [OP_PRINTLN] = 1,
+        [OP_JUMP_IF_FALSE] = 1,
+        [OP_JUMP_IF_FALSE_DISCARD] = 1,
+        [OP_JUMP_IF_TRUE] = 1,
+};
+
+typedef struct {
+    int entry;           // Address of the function's OP_UP_SCOPE
+    int frame_size;
+    int operand_count;
+    Table names;         // Names of operands & locals assigned in the body
+    int local_count;     // Locals other than the operands
+    int max_depth;       // Highest temporary count on top of the locals
+} FunctionFrame;
+
+typedef struct {
+    Chunk* chunk;
+    // Runtime the chunk got compiled in, for the natives it calls
+    const Runtime* runtime;
+    bool* boundaries;
+    int* heights;
+    int* contexts;       // Function owning each instruction, TOP_LEVEL, or UNVISITED
+    int* function_at;    // Function entered at each address, or -1
+    int* worklist;
+    int worklist_count;
+    FunctionFrame* functions;
+    int function_count;
+    int top_max_depth;
+    bool hadError;
+} Verifier;
+
+static void verifyError(Verifier* verifier, int address, const char* message) {
+    fprintf(stderr, "[bytecode %d] Verification error: %s\n", address, message);
+    verifier->hadError = true;
+}
+
+static uint16_t readShort(Chunk* chunk, int address) {
+    return (uint16_t)((chunk->bytecode_array[address] << 8) | chunk->bytecode_array[address + 1]);
+}
+
+static Value constantOperand(Chunk* chunk, int address) {
+    return chunk->constant_array.values[chunk->bytecode_array[address]];
+}
+
+// Checks every instruction decodes & references existing constants and globals.
+static void decodeInstructions(Verifier* verifier) {
+    Chunk* chunk = verifier->chunk;
+    int constant_count = chunk->constant_array.current_index;
+    int global_count = chunk->global_names.current_index;
+    int memo_count = chunk->memo_names.current_index;
+
+    for (int pc = 0; pc < chunk->current_index;) {
+        uint8_t op = chunk->bytecode_array[pc];
+        if (op >= OP_CODE_COUNT) {
+            verifyError(verifier, pc, "Invalid opcode.");
+            return;
+        }
+        int length = instructionLength(op);
+        if (pc + length > chunk->current_index) {
+            verifyError(verifier, pc, "Instruction operands run past end of chunk.");
+            return;
+        }
+        verifier->boundaries[pc] = true;
+
+        switch (op) {
+            case OP_CONSTANT:
+            case OP_SET_VAR:
+            case OP_GET_VAR:
+            case OP_GET_VAR_GLOBAL: {
+                if (chunk->bytecode_array[pc + 1] >= constant_count) {
+                    verifyError(verifier, pc, "Constant index out of range.");
+                    break;
+                }
+                Value constant = constantOperand(chunk, pc + 1);
+                if (op != OP_CONSTANT && constant.type != OBJECT_STRING_TYPE) {
+                    verifyError(verifier, pc, "Variable name must be a string.");
+                }
+                if ((op == OP_GET_VAR || op == OP_GET_VAR_GLOBAL) && chunk->bytecode_array[pc + 2] >= global_count) {
+                    verifyError(verifier, pc, "Global slot out of range.");
+                }
+                break;
+            }
+            case OP_ASSIGN_LOCAL: {
+                if (chunk->bytecode_array[pc + 2] >= constant_count ||
+                    constantOperand(chunk, pc + 2).type != OBJECT_STRING_TYPE) {
+                    verifyError(verifier, pc, "Variable name must be a string constant.");
+                }
+                break;
+            }
+            case OP_MEMO_LOOKUP:
+            case OP_MEMO_STORE: {
+                int name_operand = op == OP_MEMO_LOOKUP ? pc + 3 : pc + 2;
+                if (chunk->bytecode_array[pc + 1] >= memo_count) {
+                    verifyError(verifier, pc, "Memo table out of range.");
+                } else if (op == OP_MEMO_LOOKUP && chunk->bytecode_array[pc + 2] > MEMO_OPERAND_LIMIT) {
+                    verifyError(verifier, pc, "Too many operands for a memo key.");
+                } else if (chunk->bytecode_array[name_operand] >= constant_count ||
+                           constantOperand(chunk, name_operand).type != OBJECT_STRING_TYPE) {
+                    verifyError(verifier, pc, "Variable name must be a string constant.");
+                }
+                break;
+            }
+            case OP_CALL_NATIVE: {
+                if (chunk->bytecode_array[pc + 1] >= verifier->runtime->native_count) {
+                    verifyError(verifier, pc, "Native function out of range.");
+                }
+                break;
+            }
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL: {
+                if (chunk->bytecode_array[pc + 1] >= global_count) {
+                    verifyError(verifier, pc, "Global slot out of range.");
+                }
+                break;
+            }
+            case OP_FOR_RANGE_ENTER:
+            case OP_FOR_RANGE: {
+                for (int i = 1; i <= 3; i++) {
+                    if (chunk->bytecode_array[pc + i] >= global_count) {
+                        verifyError(verifier, pc, "Global slot out of range.");
+                        break;
+                    }
+                }
+                break;
+            }
+            case OP_FOR_RANGE_ENTER_VAR:
+            case OP_FOR_RANGE_VAR: {
+                for (int i = 1; i <= 3; i++) {
+                    if (chunk->bytecode_array[pc + i] >= constant_count ||
+                        constantOperand(chunk, pc + i).type != OBJECT_STRING_TYPE) {
+                        verifyError(verifier, pc, "Variable name must be a string constant.");
+                        break;
+                    }
+                }
+                break;
+            }
+            default: break;
+        }
+        pc += length;
+    }
+}
+
+static void visit(Verifier* verifier, int from, int address, int height, int context) {
+    if (address < 0 || address >= verifier->chunk->current_index || !verifier->boundaries[address]) {
+        verifyError(verifier, from, "Control flow does not land on an instruction.");
+        return;
+    }
+    if (verifier->contexts[address] == UNVISITED) {
+        verifier->contexts[address] = context;
+        verifier->heights[address] = height;
+        verifier->worklist[verifier->worklist_count++] = address;
+    } else if (verifier->contexts[address] != context) {
+        verifyError(verifier, from, "Instruction reachable from two different frames.");
+    } else if (verifier->heights[address] != height) {
+        verifyError(verifier, from, "Inconsistent stack height.");
+    }
+}
+
+// Registers the function entered at entry & queues its body. Returns its index, or -1.
+static int enterFunction(Verifier* verifier, int from, int entry) {
+    Chunk* chunk = verifier->chunk;
+    if (entry < 0 || entry >= chunk->current_index || !verifier->boundaries[entry] ||
+        chunk->bytecode_array[entry] != OP_UP_SCOPE) {
+        verifyError(verifier, from, "Call target is not a function entry.");
+        return -1;
+    }
+    if (verifier->function_at[entry] >= 0) return verifier->function_at[entry];
+
+    int index = verifier->function_count++;
+    verifier->function_at[entry] = index;
+    FunctionFrame* function = &verifier->functions[index];
+    function->entry = entry;
+    function->frame_size = readShort(chunk, entry + 1);
+    function->local_count = 0;
+    function->max_depth = 0;
+    initTable(&function->names);
+
+    // Operand prologue: OP_ASSIGN_LOCAL 1, OP_ASSIGN_LOCAL 2, ...
+    int pc = entry + instructionLength(OP_UP_SCOPE);
+    int operand_count = 0;
+    while (pc < chunk->current_index && chunk->bytecode_array[pc] == OP_ASSIGN_LOCAL) {
+        if (chunk->bytecode_array[pc + 1] != operand_count + 1) {
+            verifyError(verifier, pc, "Operands must be assigned in order.");
+        }
+        tableSet(&function->names, constantOperand(chunk, pc + 2), MAKE_NONE);
+        verifier->contexts[pc] = index;
+        operand_count++;
+        pc += instructionLength(OP_ASSIGN_LOCAL);
+    }
+    function->operand_count = operand_count;
+    verifier->contexts[entry] = index;
+    visit(verifier, entry, pc, 0, index);
+    return index;
+}
+
+static void verifyInstruction(Verifier* verifier, int pc) {
+    Chunk* chunk = verifier->chunk;
+    uint8_t op = chunk->bytecode_array[pc];
+    int height = verifier->heights[pc];
+    int context = verifier->contexts[pc];
+    int next = pc + instructionLength(op);
+
+    int inputs = stack_inputs[op];
+    int effect = stackEffect(op);
+    if (op == OP_PEEK) {
+        inputs = chunk->bytecode_array[pc + 1];
+        if (inputs == 0) {
+            verifyError(verifier, pc, "Peek distance must be positive.");
+            return;
+        }
+    } else if (op == OP_SQUASH) {
+        inputs = chunk->bytecode_array[pc + 1] + 1;
+        effect = -chunk->bytecode_array[pc + 1];
+    } else if (op == OP_BUILD_LIST) {
+        inputs = chunk->bytecode_array[pc + 1];
+        effect = 1 - inputs;
+    } else if (op == OP_BUILD_MAP) {
+        inputs = 2 * chunk->bytecode_array[pc + 1];
+        effect = 1 - inputs;
+    } else if (op == OP_CALL_NATIVE) {
+        inputs = verifier->runtime->natives[chunk->bytecode_array[pc + 1]].arity;
+        effect = 1 - inputs;
+    }
+    if (height < inputs) {
+        verifyError(verifier, pc, "Stack underflow.");
+        return;
+    }
+    int new_height = height + effect;
+    int* max_depth = context == TOP_LEVEL ? &verifier->top_max_depth : &verifier->functions[context].max_depth;
+    if (new_height > *max_depth) *max_depth = new_height;
+
+    switch (op) {
+        case OP_UP_SCOPE:
+            verifyError(verifier, pc, "Function entered without a call.");
+            return;
+        case OP_ASSIGN_LOCAL:
+            verifyError(verifier, pc, "Operand assignment outside of a function entry.");
+            return;
+        case OP_SET_VAR: {
+            if (context == TOP_LEVEL) {
+                verifyError(verifier, pc, "Local assignment outside of a function.");
+                return;
+            }
+            // Locals are created at the statement level, right below the temporaries
+            if (height != 1) {
+                verifyError(verifier, pc, "Local assignment with temporaries on the stack.");
+                return;
+            }
+            FunctionFrame* function = &verifier->functions[context];
+            if (tableSet(&function->names, constantOperand(chunk, pc + 1), MAKE_NONE)) function->local_count++;
+            break;
+        }
+        case OP_MEMO_LOOKUP: {
+            // Right after the operand prologue, the key gets pushed as a local on top of the operands
+            if (context == TOP_LEVEL) {
+                verifyError(verifier, pc, "Memo lookup outside of a function prologue.");
+                return;
+            }
+            FunctionFrame* function = &verifier->functions[context];
+            int prologue_end = function->entry + instructionLength(OP_UP_SCOPE) +
+                    function->operand_count * instructionLength(OP_ASSIGN_LOCAL);
+            if (pc != prologue_end || chunk->bytecode_array[pc + 2] != function->operand_count) {
+                verifyError(verifier, pc, "Memo lookup outside of a function prologue.");
+                return;
+            }
+            if (tableSet(&function->names, constantOperand(chunk, pc + 3), MAKE_NONE)) function->local_count++;
+            break;
+        }
+        case OP_MEMO_STORE:
+            if (context == TOP_LEVEL || height < 1) {
+                verifyError(verifier, pc, "Memo store without a result on the stack.");
+                return;
+            }
+            break;
+        case OP_JUMP:
+            visit(verifier, pc, readShort(chunk, pc + 1), new_height, context);
+            return;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_FALSE_DISCARD:
+        case OP_JUMP_IF_TRUE:
+            visit(verifier, pc, readShort(chunk, pc + 1), new_height, context);
+            break;
+        case OP_FOR_RANGE_ENTER_VAR:
+        case OP_FOR_RANGE_VAR:
+            if (context == TOP_LEVEL) {
+                verifyError(verifier, pc, "Local range loop outside of a function.");
+                return;
+            }
+            // Fall through
+        case OP_FOR_RANGE_ENTER:
+        case OP_FOR_RANGE:
+            visit(verifier, pc, readShort(chunk, pc + 4), new_height, context);
+            break;
+        case OP_RA_PUSH: {
+            // A call: OP_RA_PUSH, OP_JUMP <function entry>, returning right after the jump
+            int jump = next;
+            int return_address = jump + instructionLength(OP_JUMP);
+            if (jump >= chunk->current_index || chunk->bytecode_array[jump] != OP_JUMP) {
+                verifyError(verifier, pc, "Malformed function call.");
+                return;
+            }
+            int function = enterFunction(verifier, pc, readShort(chunk, jump + 1));
+            if (function < 0) return;
+            int operand_count = verifier->functions[function].operand_count;
+            if (height < operand_count) {
+                verifyError(verifier, pc, "Stack underflow.");
+                return;
+            }
+            verifier->contexts[jump] = context;
+            visit(verifier, pc, return_address, height - operand_count, context);
+            return;
+        }
+        case OP_TAIL_CALL: {
+            // OP_TAIL_CALL <operand count> <function entry>, only the operands may be left on the stack
+            if (context == TOP_LEVEL) {
+                verifyError(verifier, pc, "Tail call outside of a function.");
+                return;
+            }
+            int operand_count = chunk->bytecode_array[pc + 1];
+            if (height != operand_count) {
+                verifyError(verifier, pc, "Tail call with temporaries on the stack.");
+                return;
+            }
+            int function = enterFunction(verifier, pc, readShort(chunk, pc + 2));
+            if (function >= 0 && verifier->functions[function].operand_count != operand_count) {
+                verifyError(verifier, pc, "Incorrect number of operands for tail call.");
+            }
+            return;
+        }
+        case OP_RETURN:
+            if (context != TOP_LEVEL && height < 1) {
+                verifyError(verifier, pc, "Stack underflow.");
+            }
+            return;
+        default:
+            break;
+    }
+
+    if (next >= chunk->current_index) {
+        verifyError(verifier, pc, "Execution runs past end of chunk.");
+        return;
+    }
+    visit(verifier, pc, next, new_height, context);
+}
+
+// The frame size reserved on function entry must fit operands, locals & temporaries.
+static void verifyFrameSizes(Verifier* verifier) {
+    for (int i = 0; i < verifier->function_count; i++) {
+        FunctionFrame* function = &verifier->functions[i];
+        int required = function->operand_count + function->local_count + function->max_depth;
+        if (function->frame_size < required) {
+            verifyError(verifier, function->entry, "Frame size too small for function.");
+        }
+    }
+    if (verifier->chunk->max_stack_depth < verifier->top_max_depth) {
+        verifyError(verifier, 0, "Stack depth too small for top level code.");
+    }
+}
+
+bool verifyChunk(Chunk* chunk, const Runtime* runtime) {
+    if (chunk->verified) return true;
+    int size = chunk->current_index;
+    if (size == 0) return false;
+
+    Verifier verifier;
+    verifier.chunk = chunk;
+    verifier.runtime = runtime;
+    verifier.boundaries = ALLOCATE(bool, size);
+    verifier.heights = ALLOCATE(int, size);
+    verifier.contexts = ALLOCATE(int, size);
+    verifier.function_at = ALLOCATE(int, size);
+    verifier.worklist = ALLOCATE(int, size);
+    verifier.functions = ALLOCATE(FunctionFrame, size);
+    verifier.worklist_count = 0;
+    verifier.function_count = 0;
+    verifier.top_max_depth = 0;
+    verifier.hadError = false;
+    for (int i = 0; i < size; i++) {
+        verifier.boundaries[i] = false;
+        verifier.contexts[i] = UNVISITED;
+        verifier.function_at[i] = -1;
+    }
+
+    decodeInstructions(&verifier);
+    if (!verifier.hadError) {
+        visit(&verifier, 0, 0, 0, TOP_LEVEL);
+        while (verifier.worklist_count > 0 && !verifier.hadError) {
+            verifyInstruction(&verifier, verifier.worklist[--verifier.worklist_count]);
+        }
+    }
+    if (!verifier.hadError) verifyFrameSizes(&verifier);
+
+    for (int i = 0; i < verifier.function_count; i++) {
+        freeTable(&verifier.functions[i].names);
+    }
+    FREE_ARRAY(bool, verifier.boundaries, size);
+    FREE_ARRAY(int, verifier.heights, size);
+    FREE_ARRAY(int, verifier.contexts, size);
+    FREE_ARRAY(int, verifier.function_at, size);
+    FREE_ARRAY(int, verifier.worklist, size);
+    FREE_ARRAY(FunctionFrame, verifier.functions, size);
+
+    chunk->verified = !verifier.hadError;
+    return chunk->verified;
+}
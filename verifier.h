@@ -0,0 +1,13 @@
+// Module responsible for verifying bytecode once before it runs.
+// A verified chunk only contains valid opcodes & operands, jumps landing on instruction boundaries,
+// and consistent operand stack heights fitting in the frame sizes the VM reserves.
+
+#ifndef CJLANG_VERIFIER_H
+#define CJLANG_VERIFIER_H
+
+#include "chunk.h"
+#include "runtime.h"
+
+bool verifyChunk(Chunk* chunk, const Runtime* runtime);
+
+#endif //CJLANG_VERIFIER_H
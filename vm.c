@@ -2,13 +2,13 @@
 // Created by Congyu Luo on 9/25/22.
 //
 #include <string.h>
-#include <math.h>
 
 #include "vm.h"
 #include "debugTools.h"
 #include "object.h"
 #include "memory.h"
 #include "makeString.h"
+#include "number.h"
 
 
 static OperationResult runtimeError(VM* vm, char* message) {
@@ -18,18 +18,232 @@ static OperationResult runtimeError(VM* vm, char* message) {
     return RUNTIME_FAILURE;
 }
 
-void initVM(VM* vm, Chunk* chunk) {
+void initVM(VM* vm, Runtime* runtime, const Chunk* chunk) {
+    vm->runtime = runtime;
     vm->chunk = chunk;
-    vm->instruction_pointer = &vm->chunk->bytecode_array[0];
-    vm->stack_index = 0;
-    vm->ra_stack_index = 0;
-    vm->local_index = 0;
+    vm->code = chunk->bytecode_array;
+    vm->deopt_counts = NULL;
+    vm->instruction_pointer = &vm->code[0];
+    initLayeredStrTable(&vm->strings, &runtime->strings);
+    vm->hasError = false;
+    vm->scope = 0;
+    vm->returnValue = MAKE_NONE;
+    initHeap(&vm->heap, &vm->hasError);
+    useHeap(&vm->heap);
+    // Top level code needs room for its own operands
+    vm->stack_capacity = STACK_INITIAL_SIZE;
+    while (vm->stack_capacity < chunk->max_stack_depth) vm->stack_capacity *= 2;
+    vm->stack = ALLOCATE(Value, vm->stack_capacity);
     vm->stackTop = &vm->stack[0];
+    vm->ra_stack_capacity = STACK_INITIAL_SIZE;
+    vm->ra_stack = ALLOCATE(Value, vm->ra_stack_capacity);
+    vm->ra_stack_index = 0;
     vm->ra_stackTop = &vm->ra_stack[0];
+    vm->max_call_depth = DEFAULT_MAX_CALL_DEPTH;
+    vm->locals_capacity = STACK_INITIAL_SIZE;
+    vm->locals = ALLOCATE(Local, vm->locals_capacity);
+    vm->local_index = 0;
+    vm->global_count = chunk->global_names.current_index;
+    vm->globals = ALLOCATE(Global, vm->global_count);
+    for (int i = 0; i < vm->global_count; i++) {
+        vm->globals[i].value = MAKE_NONE;
+        vm->globals[i].defined = false;
+    }
+    vm->memo_count = chunk->memo_names.current_index;
+    vm->memos = ALLOCATE(MemoTable, vm->memo_count);
+    for (int i = 0; i < vm->memo_count; i++) {
+        initTable(&vm->memos[i].entries);
+        vm->memos[i].hits = 0;
+        vm->memos[i].misses = 0;
+    }
+    vm->memo_limit = DEFAULT_MEMO_LIMIT;
+    vm->objects = NULL;
+    vm->next_gc = GC_INITIAL_THRESHOLD;
+    vm->gc_count = 0;
+}
+
+static void freeObjects(VM* vm) {
+    Object* object = vm->objects;
+    while (object != NULL) {
+        Object* next = object->next;
+        freeObject(object);
+        object = next;
+    }
+    vm->objects = NULL;
+}
+
+void freeVM(VM* vm) {
+    useHeap(&vm->heap);
+    FREE_ARRAY(Value, vm->stack, vm->stack_capacity);
+    FREE_ARRAY(Value, vm->ra_stack, vm->ra_stack_capacity);
+    FREE_ARRAY(Local, vm->locals, vm->locals_capacity);
+    FREE_ARRAY(Global, vm->globals, vm->global_count);
+    for (int i = 0; i < vm->memo_count; i++) {
+        freeTable(&vm->memos[i].entries);
+    }
+    FREE_ARRAY(MemoTable, vm->memos, vm->memo_count);
+    freeObjects(vm);
+    if (vm->code != vm->chunk->bytecode_array) FREE_ARRAY(uint8_t, vm->code, vm->chunk->current_index);
+    if (vm->deopt_counts != NULL) FREE_ARRAY(uint8_t, vm->deopt_counts, vm->chunk->current_index);
+    freeStrTable(&vm->strings);
+    useHeap(NULL);
+}
+
+void resetVM(VM* vm) {
+    useHeap(&vm->heap);
+    vm->instruction_pointer = &vm->code[0];
     vm->hasError = false;
+    vm->heap.limit_exceeded = false;
     vm->scope = 0;
     vm->returnValue = MAKE_NONE;
-    initTable(&vm->globals);
+    vm->stackTop = &vm->stack[0];
+    vm->ra_stack_index = 0;
+    vm->ra_stackTop = &vm->ra_stack[0];
+    vm->local_index = 0;
+    for (int i = 0; i < vm->global_count; i++) {
+        vm->globals[i].value = MAKE_NONE;
+        vm->globals[i].defined = false;
+    }
+    for (int i = 0; i < vm->memo_count; i++) {
+        clearTable(&vm->memos[i].entries);
+        vm->memos[i].hits = 0;
+        vm->memos[i].misses = 0;
+    }
+    // Nothing refers to the strings & objects made by the last run anymore
+    clearStrTable(&vm->strings);
+    vm->heap.live_objects[OBJECT_STRING_TYPE] = 0;
+    freeObjects(vm);
+    vm->next_gc = GC_INITIAL_THRESHOLD;
+}
+
+bool nativeError(VM* vm, const char* message) {
+    vm->hasError = true;
+    fprintf(stderr, "%s", message);
+    return false;
+}
+
+// Objects found reachable but whose references aren't traced yet.
+typedef struct {
+    Object** objects;
+    int count;
+    int capacity;
+} GrayStack;
+
+static void markValue(GrayStack* gray, Value value) {
+    Object* object;
+    switch (value.type) {
+        case OBJECT_LIST_TYPE: object = &value.content.list_object->object; break;
+        case OBJECT_MAP_TYPE: object = &value.content.map_object->object; break;
+        case OBJECT_ARRAY_TYPE:
+            // Holds no references, nothing to trace
+            value.content.array_object->object.marked = true;
+            return;
+        default: return;
+    }
+    if (object->marked) return;
+    object->marked = true;
+    if (gray->count >= gray->capacity) {
+        // Kept off the VM's heap, the collector must not charge the heap it's freeing
+        gray->capacity = GROW_CAPACITY(gray->capacity);
+        gray->objects = realloc(gray->objects, sizeof(Object*) * gray->capacity);
+        if (gray->objects == NULL) exit(74);
+    }
+    gray->objects[gray->count++] = object;
+}
+
+static void markRoots(VM* vm, GrayStack* gray) {
+    // Locals live on the stack too
+    for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
+        markValue(gray, *slot);
+    }
+    for (int i = 0; i < vm->global_count; i++) {
+        markValue(gray, vm->globals[i].value);
+    }
+    markValue(gray, vm->returnValue);
+    for (int i = 0; i < vm->memo_count; i++) {
+        Table* entries = &vm->memos[i].entries;
+        for (int slot = 0; slot < entries->capacity; slot++) {
+            if (!(entries->control[slot] & 0x80)) markValue(gray, entries->values[slot]);
+        }
+    }
+}
+
+static void traceReferences(GrayStack* gray) {
+    while (gray->count > 0) {
+        Object* object = gray->objects[--gray->count];
+        if (object->type == OBJECT_LIST_TYPE) {
+            List_Object* list = (List_Object*) object;
+            for (int i = 0; i < list->count; i++) {
+                markValue(gray, list->items[i]);
+            }
+        } else if (object->type == OBJECT_MAP_TYPE) {
+            // Keys are never objects, deleted entries hold None
+            MapTable* table = &((Map_Object*) object)->table;
+            for (int i = 0; i < table->entry_count; i++) {
+                markValue(gray, table->entries[i].value);
+            }
+        }
+    }
+}
+
+static void sweep(VM* vm) {
+    Object** link = &vm->objects;
+    while (*link != NULL) {
+        Object* object = *link;
+        if (object->marked) {
+            object->marked = false;
+            link = &object->next;
+        } else {
+            *link = object->next;
+            freeObject(object);
+        }
+    }
+}
+
+// Mark & sweep over the objects of the VM, strings live in string sets & aren't collected.
+static void collectGarbage(VM* vm) {
+    GrayStack gray = {NULL, 0, 0};
+    markRoots(vm, &gray);
+    traceReferences(&gray);
+    free(gray.objects);
+    sweep(vm);
+    vm->gc_count++;
+    vm->next_gc = vm->heap.bytes_allocated * 2;
+    if (vm->next_gc < GC_INITIAL_THRESHOLD) vm->next_gc = GC_INITIAL_THRESHOLD;
+}
+
+static Object* allocateObject(VM* vm, size_t size, ValueType type) {
+    if (vm->heap.bytes_allocated > vm->next_gc) collectGarbage(vm);
+    Object* object = reallocate(NULL, 0, size);
+    object->type = type;
+    object->marked = false;
+    object->next = vm->objects;
+    vm->objects = object;
+    heapObjectAllocated(type);
+    return object;
+}
+
+List_Object* newList(VM* vm, int capacity) {
+    List_Object* list = (List_Object*) allocateObject(vm, sizeof(List_Object), OBJECT_LIST_TYPE);
+    list->count = 0;
+    list->capacity = capacity;
+    list->items = capacity > 0 ? ALLOCATE(Value, capacity) : NULL;
+    return list;
+}
+
+Map_Object* newMap(VM* vm) {
+    Map_Object* map = (Map_Object*) allocateObject(vm, sizeof(Map_Object), OBJECT_MAP_TYPE);
+    initMapTable(&map->table);
+    return map;
+}
+
+Array_Object* newArray(VM* vm, int count) {
+    Array_Object* array = (Array_Object*) allocateObject(vm, sizeof(Array_Object), OBJECT_ARRAY_TYPE);
+    array->count = count;
+    array->capacity = count;
+    array->items = count > 0 ? ALLOCATE(double, count) : NULL;
+    for (int i = 0; i < count; i++) array->items[i] = 0;
+    return array;
 }
 
 void initLocal(Local* local, Value key, int index, int scope) {
@@ -38,36 +252,51 @@ void initLocal(Local* local, Value key, int index, int scope) {
     local->scope = scope;
 }
 
-static void stackPush(VM* vm, Value value) {
-    if (vm->stack_index >= STACK_LIMIT){
-        printf("Stack limit reached.");
-        vm->hasError = true;
-    }
-
-    *vm->stackTop = value;
-    vm->stackTop++;
-    vm->stack_index++;
+// Pushes & pops are unchecked, every frame reserves the stack height computed by the compiler on entry.
+static inline void stackPush(VM* vm, Value value) {
+    *vm->stackTop++ = value;
 }
 
-static Value stackPop(VM* vm) {
-    if (vm->stack_index <= 0){
-        printf("Return address bottom reached.");
-        vm->hasError = true;
-    }
-    vm->stack_index--;
-    vm->stackTop--;
-    return *vm->stackTop;
+static inline Value stackPop(VM* vm) {
+    return *--vm->stackTop;
 }
 
-static void raStackPush(VM* vm, Value value) {
-    if (vm->ra_stack_index >= STACK_LIMIT){
-        printf("Maximum recursion / function call reached.");
-        vm->hasError = true;
+static bool raStackPush(VM* vm, Value value) {
+    if (vm->ra_stack_index >= vm->ra_stack_capacity){
+        if (vm->ra_stack_index >= vm->max_call_depth) {
+            printf("Maximum recursion depth of %d reached.", vm->max_call_depth);
+            vm->hasError = true;
+            return false;
+        }
+        int new_capacity = vm->ra_stack_capacity * 2;
+        if (new_capacity > vm->max_call_depth) new_capacity = vm->max_call_depth;
+        vm->ra_stack = GROW_ARRAY(Value, vm->ra_stack, vm->ra_stack_capacity, new_capacity);
+        vm->ra_stack_capacity = new_capacity;
+        vm->ra_stackTop = &vm->ra_stack[vm->ra_stack_index];
     }
 
     *vm->ra_stackTop = value;
     vm->ra_stackTop++;
     vm->ra_stack_index++;
+    return true;
+}
+
+// Makes sure a frame using frame_size stack slots & locals fits on top of the current one.
+static void reserveFrame(VM* vm, int frame_size) {
+    int stack_height = STACK_HEIGHT(vm);
+    if (stack_height + frame_size > vm->stack_capacity) {
+        int new_capacity = vm->stack_capacity * 2;
+        while (stack_height + frame_size > new_capacity) new_capacity *= 2;
+        vm->stack = GROW_ARRAY(Value, vm->stack, vm->stack_capacity, new_capacity);
+        vm->stack_capacity = new_capacity;
+        vm->stackTop = &vm->stack[stack_height];
+    }
+    if (vm->local_index + frame_size > vm->locals_capacity) {
+        int new_capacity = vm->locals_capacity * 2;
+        while (vm->local_index + frame_size > new_capacity) new_capacity *= 2;
+        vm->locals = GROW_ARRAY(Local, vm->locals, vm->locals_capacity, new_capacity);
+        vm->locals_capacity = new_capacity;
+    }
 }
 
 static Value raStackPop(VM* vm) {
@@ -80,50 +309,59 @@ static Value raStackPop(VM* vm) {
     return *vm->ra_stackTop;
 }
 
-static Value stackPeek(VM* vm) {
-    if (vm->stack_index <= 0){
-        printf("Attempting to peek empty stack.");
-        vm->hasError = true;
-    }
+static inline Value stackPeek(VM* vm) {
     return vm->stackTop[-1];
 }
 
-static Chunk* currentChunk(VM* vm) {
+static const Chunk* currentChunk(VM* vm) {
     return vm->chunk;
 }
 
-static double exponent(double base, double exp) {
-    double result = base;
-    for (int i=0; i<exp - 1; i++){
-        result *= base;
+// Reports a binary operation on values that aren't both numbers.
+static OperationResult operandTypeError(VM* vm, Value v1, Value v2, char* message) {
+    if (v1.type != v2.type && !(IS_NUMERIC(v1) && IS_NUMERIC(v2))) {
+        return runtimeError(vm, "Cannot perform binary operation on values of different types.");
     }
-    return result;
+    return runtimeError(vm, message);
 }
 
-static bool getLocal(VM* vm, Value key, Value* v) {
+// Stack slot of the local in the current scope, NULL if there's none with that name.
+static Value* findLocal(VM* vm, Value key) {
     if (vm->local_index == 0 || key.type != OBJECT_STRING_TYPE){
-        return false;
+        return NULL;
     }
     for (int i=vm->local_index - 1; i>=0; i--) {
         Local current_local = vm->locals[i];
         // Break if different scope has been reached
         if (current_local.scope < vm->scope) {
-            return false;
+            return NULL;
         }
         // Compare key
         if (current_local.key.content.string_object == key.content.string_object){
-            // Set v to value
-            *v = vm->stack[current_local.index];
-            return true;
+            return &vm->stack[current_local.index];
         }
     }
-    return false;
+    return NULL;
+}
+
+static bool getLocal(VM* vm, Value key, Value* v) {
+    Value* local = findLocal(vm, key);
+    if (local == NULL) return false;
+    *v = *local;
+    return true;
 }
 
 static void setLocal(VM* vm, Value key, Value v) {
+    // Update the local if the name already lives in the current scope
+    for (int i=vm->local_index - 1; i>=0 && vm->locals[i].scope >= vm->scope; i--) {
+        if (vm->locals[i].key.content.string_object == key.content.string_object) {
+            vm->stack[vm->locals[i].index] = v;
+            return;
+        }
+    }
     // Store location of value on vm's stack as a local
     Local local;
-    initLocal(&local, key, vm->stack_index, vm->scope);
+    initLocal(&local, key, STACK_HEIGHT(vm), vm->scope);
     // Push value to stack
     stackPush(vm, v);
     // Add new local to vm's local array
@@ -135,7 +373,7 @@ static void setLocal(VM* vm, Value key, Value v) {
 static void assignLocal(VM* vm, Value key, uint8_t offset) {
     // Store location of value on vm's stack as a local
     Local local;
-    initLocal(&local, key, vm->stack_index - offset, vm->scope);
+    initLocal(&local, key, STACK_HEIGHT(vm) - offset, vm->scope);
     // Add new local to vm's local array
     vm->locals[vm->local_index] = local;
     // Increment local index
@@ -161,27 +399,213 @@ static void cleanLocalsAtScope(VM* vm) {
     vm->local_index -= local_count;
 }
 
-static bool jump(VM* vm) {
+// Leaves the current function, handing value back to its caller.
+static inline void returnFromFunction(VM* vm, Value value) {
+    vm->returnValue = value;
+    cleanLocalsAtScope(vm);
+    vm->scope -= 1;
+    vm->instruction_pointer = &vm->code[(int) raStackPop(vm).content.number_value];
+}
+
+// Writes the memo key of the operands on top of the stack into key & returns its length.
+// Strings are interned, so their address identifies them.
+// A list may change after a result got cached, calls with one get no key: -1.
+static int memoKey(VM* vm, int operand_count, char* key) {
+    int length = 0;
+    for (Value* operand = vm->stackTop - operand_count; operand < vm->stackTop; operand++) {
+        key[length++] = (char) operand->type;
+        switch (operand->type) {
+            case NUMBER_TYPE:
+                memcpy(&key[length], &operand->content.number_value, sizeof(double));
+                length += sizeof(double);
+                break;
+            case INTEGER_TYPE:
+                memcpy(&key[length], &operand->content.integer_value, sizeof(int64_t));
+                length += sizeof(int64_t);
+                break;
+            case OBJECT_STRING_TYPE:
+                memcpy(&key[length], &operand->content.string_object, sizeof(String_Object*));
+                length += sizeof(String_Object*);
+                break;
+            case BOOL_TYPE:
+                key[length++] = (char) operand->content.bool_value;
+                break;
+            case OBJECT_LIST_TYPE:
+            case OBJECT_ARRAY_TYPE:
+            case OBJECT_MAP_TYPE:
+                return -1;
+            default:
+                break;
+        }
+    }
+    return length;
+}
+
+// Drops the current function's locals & moves the call's operands down to where they started,
+// the callee's frame then takes the place of the current one.
+static void dropFrameForTailCall(VM* vm, int operand_count) {
+    int local_count = 0;
+    while (local_count < vm->local_index && vm->locals[vm->local_index - 1 - local_count].scope >= vm->scope) {
+        local_count++;
+    }
+    Value* operands = vm->stackTop - operand_count;
+    memmove(operands - local_count, operands, sizeof(Value) * operand_count);
+    vm->stackTop -= local_count;
+    vm->local_index -= local_count;
+    vm->scope -= 1;
+}
+
+// Switches the VM over to a copy of the chunk's bytecode it may rewrite, the chunk itself stays untouched.
+static void copyCode(VM* vm) {
+    int length = vm->chunk->current_index;
+    uint8_t* code = ALLOCATE(uint8_t, length);
+    memcpy(code, vm->chunk->bytecode_array, length);
+    vm->instruction_pointer = code + (vm->instruction_pointer - vm->code);
+    vm->code = code;
+}
+
+// Rewrites the instruction being executed into a form specialized for the operand types just seen.
+static inline void quicken(VM* vm, OpCode specialized_op) {
+    if (vm->deopt_counts != NULL &&
+        vm->deopt_counts[vm->instruction_pointer - 1 - vm->code] >= QUICKEN_DEOPT_LIMIT) {
+        return;
+    }
+    if (vm->code == vm->chunk->bytecode_array) copyCode(vm);
+    vm->instruction_pointer[-1] = specialized_op;
+}
+
+// Turns the instruction being executed back into its generic form & executes that instead.
+// Only quickened instructions deoptimize, so the VM already runs its own copy of the code.
+static void deoptimize(VM* vm, OpCode generic_op) {
+    int length = vm->chunk->current_index;
+    uint8_t* instruction = vm->instruction_pointer - 1;
+    if (vm->deopt_counts == NULL) {
+        vm->deopt_counts = ALLOCATE(uint8_t, length);
+        memset(vm->deopt_counts, 0, length);
+    }
+    uint8_t* count = &vm->deopt_counts[instruction - vm->code];
+    if (*count < QUICKEN_DEOPT_LIMIT) (*count)++;
+    *instruction = generic_op;
+    vm->instruction_pointer = instruction;
+}
+
+// Checks container & index, returns the position of the item or -1 after printing the error.
+static int itemIndex(VM* vm, Value container, Value index) {
+    int count;
+    switch (container.type) {
+        case OBJECT_LIST_TYPE: count = container.content.list_object->count; break;
+        case OBJECT_ARRAY_TYPE: count = container.content.array_object->count; break;
+        default:
+            printf("Can only index LIST_TYPE & ARRY_TYPE values.");
+            return -1;
+    }
+    if (!IS_NUMERIC(index)) {
+        printf("List index must be an integer.");
+        return -1;
+    }
+    double position = AS_DOUBLE(index);
+    if (!(position >= 0 && position < count)) {
+        printf("List index %g out of range for %d items.", position, count);
+        return -1;
+    }
+    if (position != (int) position) {
+        printf("List index must be an integer.");
+        return -1;
+    }
+    return (int) position;
+}
+
+// Checks the key can be looked up in a map, returns false after printing the error.
+static bool checkMapKey(Value map, Value key) {
+    if (map.type != OBJECT_MAP_TYPE) {
+        printf("Can only look up keys in MAP_TYPE values.");
+        return false;
+    }
+    if (!isMapKey(key)) {
+        printf("Map keys must be numbers, bools or strings, and not NaN.");
+        return false;
+    }
+    return true;
+}
+
+static OperationResult missingKey(VM* vm, Value key) {
+    printf("Key ");
+    printValue(key);
+    printf(" not found in map.");
+    return runtimeError(vm, "");
+}
+
+// Jump targets were checked by the verifier, no bounds check needed here.
+static inline void jump(VM* vm) {
 #define READ_SHORT() (vm->instruction_pointer += 2, (uint16_t)((vm->instruction_pointer[-2] << 8) | vm->instruction_pointer[-1]))
     uint16_t offset = READ_SHORT();
-    if (offset >= vm->chunk->current_index){
-        return false;
+    vm->instruction_pointer = &vm->code[offset];
+}
+
+// Reads the counter, limit & step operands of a range loop instruction, in globals or in locals of the frame.
+// Returns false after reporting a missing local.
+static bool rangeVariables(VM* vm, bool locals, Value* range[3]) {
+    for (int i = 0; i < 3; i++) {
+        uint8_t operand = *vm->instruction_pointer++;
+        if (!locals) {
+            range[i] = &vm->globals[operand].value;
+            continue;
+        }
+        Value name = currentChunk(vm)->constant_array.values[operand];
+        range[i] = findLocal(vm, name);
+        if (range[i] == NULL) {
+            printf("Variable with name '%.*s' does not exist in current scope.", name.content.string_object->length, name.content.string_object->cString);
+            return false;
+        }
     }
-    vm->instruction_pointer = &vm->chunk->bytecode_array[offset];
     return true;
 }
 
+// Counts up to the limit excluded, or down to it for a negative step.
+static inline bool inRange(Value counter, Value limit, Value step) {
+    if (counter.type == INTEGER_TYPE && limit.type == INTEGER_TYPE && step.type == INTEGER_TYPE) {
+        return step.content.integer_value > 0 ? counter.content.integer_value < limit.content.integer_value
+                                              : counter.content.integer_value > limit.content.integer_value;
+    }
+    return AS_DOUBLE(step) > 0 ? AS_DOUBLE(counter) < AS_DOUBLE(limit) : AS_DOUBLE(counter) > AS_DOUBLE(limit);
+}
+
+#define NUMBER_BINARY(operation) \
+    do { \
+        Value right = stackPop(vm); \
+        vm->stackTop[-1] = operation(vm->stackTop[-1], right); \
+    } while (false)
+
+#define GUARDED_NUMBER_BINARY(operation, generic_op) \
+    do { \
+        if (!IS_NUMERIC(vm->stackTop[-1]) || !IS_NUMERIC(vm->stackTop[-2])) { \
+            deoptimize(vm, generic_op); \
+            break; \
+        } \
+        NUMBER_BINARY(operation); \
+    } while (false)
+
 OperationResult run(VM* vm){
 #ifdef RUNTIME_SHOW_EXECUTION
     int cycle_count = 0;
 #endif
+    // Several VMs may take turns on one thread, allocations are charged to the one running
+    useHeap(&vm->heap);
+    // Verified when it got compiled, a shared chunk must not be written here
+    if (!vm->chunk->verified) {
+        return runtimeError(vm, "Bytecode verification failed.");
+    }
 
     for (;;) {
         if (vm->hasError) {
+            if (vm->heap.limit_exceeded) {
+                printf("Heap limit of %zu bytes exceeded.", vm->heap.limit);
+                return runtimeError(vm, "");
+            }
             return RUNTIME_FAILURE;
         }
         // Get current chunk
-        Chunk* current_chunk = currentChunk(vm);
+        const Chunk* current_chunk = currentChunk(vm);
         // Get next instruction
         uint8_t curr_instruction = *vm->instruction_pointer++;
 
@@ -201,54 +625,60 @@ OperationResult run(VM* vm){
                 stackPop(vm);
                 break;
             }
-            case OP_GET_TYPE: {
-                stackPush(vm, makeStrValue(strValueType(stackPop(vm)), 9));
-                break;
-            }
-            case OP_GET_LEN: {
-                Value v = stackPop(vm);
-                if (v.type != OBJECT_STRING_TYPE) {
-                    return runtimeError(vm, "Can only use len() on OBJ_STRING type.");
-                }
-                stackPush(vm, MAKE_NUMBER(v.content.string_object->length));
+            case OP_PEEK: {
+                uint8_t distance = *vm->instruction_pointer++;
+                stackPush(vm, vm->stackTop[-distance]);
                 break;
             }
-            case OP_GET_TIME: {
-                stackPush(vm, MAKE_NUMBER(time(NULL)));
+            case OP_SQUASH: {
+                // Drops count values from under the top of the stack
+                uint8_t count = *vm->instruction_pointer++;
+                Value top = stackPop(vm);
+                vm->stackTop -= count;
+                stackPush(vm, top);
                 break;
             }
             case OP_GET_VAR: {
                 // First get key value
                 Value key_value = current_chunk->constant_array.values[*vm->instruction_pointer++];
+                uint8_t slot = *vm->instruction_pointer++;
                 Value v1;
-                // If not currently in global scope, prioritize search in local scope
-                if (vm->scope > 0 && getLocal(vm, key_value, &v1)) {
+                // Prioritize search in local scope, fall back to the global slot
+                if (getLocal(vm, key_value, &v1)) {
                     stackPush(vm, v1);
-                } else { // Else, search in global scope
-                    Value v;
-                    if (tableGet(&vm->globals, key_value, &v)){
-                        stackPush(vm, v);
-                    } else {
-                        if (vm->scope == 0) {
-                            printf("Variable with name '%.*s' does not exist in global scope.", key_value.content.string_object->length, key_value.content.string_object->cString);
-                        } else {
-                            printf("Variable with name '%.*s' does not exist in current scope or global scope.", key_value.content.string_object->length, key_value.content.string_object->cString);
-                        }
-                        return runtimeError(vm, "");
-                    }
+                } else if (vm->globals[slot].defined) {
+                    stackPush(vm, vm->globals[slot].value);
+                } else {
+                    printf("Variable with name '%.*s' does not exist in current scope or global scope.", key_value.content.string_object->length, key_value.content.string_object->cString);
+                    return runtimeError(vm, "");
                 }
                 break;
             }
+            case OP_GET_VAR_GLOBAL: {
+                // Name can't be a local of this frame, go straight to the global slot
+                Value key_value = current_chunk->constant_array.values[*vm->instruction_pointer++];
+                Global* global = &vm->globals[*vm->instruction_pointer++];
+                if (!global->defined) {
+                    printf("Variable with name '%.*s' does not exist in current scope or global scope.", key_value.content.string_object->length, key_value.content.string_object->cString);
+                    return runtimeError(vm, "");
+                }
+                stackPush(vm, global->value);
+                break;
+            }
+            case OP_GET_GLOBAL: {
+                uint8_t slot = *vm->instruction_pointer++;
+                Global* global = &vm->globals[slot];
+                if (!global->defined) {
+                    String_Object* name = current_chunk->global_names.values[slot].content.string_object;
+                    printf("Variable with name '%.*s' does not exist in global scope.", name->length, name->cString);
+                    return runtimeError(vm, "");
+                }
+                stackPush(vm, global->value);
+                break;
+            }
             case OP_SET_VAR: {
                 Value key = current_chunk->constant_array.values[*vm->instruction_pointer++];
-                if (vm->scope > 0) {
-                    if (key.type != OBJECT_STRING_TYPE) {
-                        return runtimeError(vm, "Key for variable must be string type");
-                    }
-                    setLocal(vm, key, stackPop(vm));
-                } else {
-                    tableSet(&vm->globals, key, stackPop(vm));
-                }
+                setLocal(vm, key, stackPop(vm));
                 break;
             }
             case OP_ASSIGN_LOCAL: {
@@ -257,12 +687,92 @@ OperationResult run(VM* vm){
                 assignLocal(vm, key, offset);
                 break;
             }
+            case OP_BUILD_LIST: {
+                int count = *vm->instruction_pointer++;
+                // The items stay on the stack until copied, a collection can't free what they refer to
+                List_Object* list = newList(vm, count);
+                if (count > 0) memcpy(list->items, vm->stackTop - count, sizeof(Value) * count);
+                list->count = count;
+                vm->stackTop -= count;
+                stackPush(vm, MAKE_OBJ_LIST(list));
+                break;
+            }
+            case OP_GET_INDEX: {
+                Value index = stackPop(vm);
+                Value container = stackPop(vm);
+                if (container.type == OBJECT_MAP_TYPE) {
+                    Value value;
+                    if (!checkMapKey(container, index)) return runtimeError(vm, "");
+                    if (!mapTableGet(&container.content.map_object->table, index, &value)) return missingKey(vm, index);
+                    stackPush(vm, value);
+                    break;
+                }
+                int position = itemIndex(vm, container, index);
+                if (position < 0) return runtimeError(vm, "");
+                if (container.type == OBJECT_ARRAY_TYPE) {
+                    stackPush(vm, MAKE_NUMBER(container.content.array_object->items[position]));
+                } else {
+                    stackPush(vm, container.content.list_object->items[position]);
+                }
+                break;
+            }
+            case OP_SET_INDEX: {
+                Value value = stackPop(vm);
+                Value index = stackPop(vm);
+                Value container = stackPop(vm);
+                if (container.type == OBJECT_MAP_TYPE) {
+                    if (!checkMapKey(container, index)) return runtimeError(vm, "");
+                    mapTableSet(&container.content.map_object->table, index, value);
+                    break;
+                }
+                int position = itemIndex(vm, container, index);
+                if (position < 0) return runtimeError(vm, "");
+                if (container.type == OBJECT_LIST_TYPE) {
+                    container.content.list_object->items[position] = value;
+                } else if (IS_NUMERIC(value)) {
+                    container.content.array_object->items[position] = AS_DOUBLE(value);
+                } else {
+                    return runtimeError(vm, "Can only store numbers in ARRY_TYPE values.");
+                }
+                break;
+            }
+            case OP_BUILD_MAP: {
+                int count = *vm->instruction_pointer++;
+                Map_Object* map = newMap(vm);
+                // Entries stay on the stack until the map is complete, later duplicates win
+                for (Value* entry = vm->stackTop - 2 * count; entry < vm->stackTop; entry += 2) {
+                    if (!isMapKey(entry[0])) return runtimeError(vm, "Map keys must be numbers, bools or strings, and not NaN.");
+                    mapTableSet(&map->table, entry[0], entry[1]);
+                }
+                vm->stackTop -= 2 * count;
+                stackPush(vm, MAKE_OBJ_MAP(map));
+                break;
+            }
+            case OP_DELETE_KEY: {
+                Value key = stackPop(vm);
+                Value map = stackPop(vm);
+                if (!checkMapKey(map, key)) return runtimeError(vm, "");
+                if (!mapTableDelete(&map.content.map_object->table, key)) return missingKey(vm, key);
+                break;
+            }
+            case OP_HAS_KEY: {
+                Value map = stackPop(vm);
+                Value key = stackPop(vm);
+                if (!checkMapKey(map, key)) return runtimeError(vm, "");
+                Value unused;
+                stackPush(vm, MAKE_BOOL(mapTableGet(&map.content.map_object->table, key, &unused)));
+                break;
+            }
             case OP_SET_GLOBAL: {
-                Value key = current_chunk->constant_array.values[*vm->instruction_pointer++];
-                tableSet(&vm->globals, key, stackPop(vm));
+                Global* global = &vm->globals[*vm->instruction_pointer++];
+                global->value = stackPop(vm);
+                global->defined = true;
                 break;
             }
             case OP_UP_SCOPE: {
+                uint16_t frame_size = (uint16_t)((vm->instruction_pointer[0] << 8) | vm->instruction_pointer[1]);
+                vm->instruction_pointer += 2;
+                reserveFrame(vm, frame_size);
                 vm->scope += 1;
                 break;
             }
@@ -273,14 +783,19 @@ OperationResult run(VM* vm){
             }
             case OP_EQUAL: {
                 Value v2 = stackPop(vm); Value v1 = stackPop(vm);
-                if (v1.type != v2.type) {
+                if (IS_NUMERIC(v1) && IS_NUMERIC(v2)) {
+                    stackPush(vm, equalNumbers(v1, v2));
+                } else if (v1.type != v2.type) {
                     stackPush(vm, MAKE_BOOL(false));
                 } else {
                     switch (v1.type) {
                         case OBJECT_STRING_TYPE: stackPush(vm, MAKE_BOOL(v1.content.string_object == v2.content.string_object)); break;
-                        case NUMBER_TYPE: stackPush(vm, MAKE_BOOL(v1.content.number_value == v2.content.number_value)); break;
                         case BOOL_TYPE: stackPush(vm, MAKE_BOOL(v1.content.bool_value == v2.content.bool_value)); break;
                         case NONE_TYPE: stackPush(vm, MAKE_BOOL(true)); break;
+                        // The same list, not equal items
+                        case OBJECT_LIST_TYPE: stackPush(vm, MAKE_BOOL(v1.content.list_object == v2.content.list_object)); break;
+                        case OBJECT_ARRAY_TYPE: stackPush(vm, MAKE_BOOL(v1.content.array_object == v2.content.array_object)); break;
+                        case OBJECT_MAP_TYPE: stackPush(vm, MAKE_BOOL(v1.content.map_object == v2.content.map_object)); break;
                         default: return runtimeError(vm, "Unsupported operand type.");
                     }
                 }
@@ -288,22 +803,16 @@ OperationResult run(VM* vm){
             }
             case OP_GREATER: {
                 Value v2 = stackPop(vm); Value v1 = stackPop(vm);
-                if (v1.type != v2.type) {
-                    return runtimeError(vm, "Cannot perform binary operation on values of different types.");
-                } else if (v1.type != NUMBER_TYPE) {
-                    return runtimeError(vm, "Cannot compare non-number values.");
-                }
-                stackPush(vm, MAKE_BOOL(v1.content.number_value > v2.content.number_value));
+                if (!IS_NUMERIC(v1) || !IS_NUMERIC(v2)) return operandTypeError(vm, v1, v2, "Cannot compare non-number values.");
+                quicken(vm, OP_GREATER_NUM_GUARDED);
+                stackPush(vm, greaterNumbers(v1, v2));
                 break;
             }
             case OP_LESS: {
                 Value v2 = stackPop(vm); Value v1 = stackPop(vm);
-                if (v1.type != v2.type) {
-                    return runtimeError(vm, "Cannot perform binary operation on values of different types.");
-                } else if (v1.type != NUMBER_TYPE) {
-                    return runtimeError(vm, "Cannot compare non-number values.");
-                }
-                stackPush(vm, MAKE_BOOL(v1.content.number_value < v2.content.number_value));
+                if (!IS_NUMERIC(v1) || !IS_NUMERIC(v2)) return operandTypeError(vm, v1, v2, "Cannot compare non-number values.");
+                quicken(vm, OP_LESS_NUM_GUARDED);
+                stackPush(vm, lessNumbers(v1, v2));
                 break;
             }
             case OP_NOT: {
@@ -316,68 +825,79 @@ OperationResult run(VM* vm){
             }
             case OP_ADD: {
                     Value v2 = stackPop(vm); Value v1 = stackPop(vm);
-                    if (v1.type != v2.type) {
-                        return runtimeError(vm, "Cannot perform binary operation on values of different types.");
-                    } else if ((v1.type != NUMBER_TYPE) && (v1.type != OBJECT_STRING_TYPE)) {
-                        return runtimeError(vm, "Unsupported operand type.");
-                    }
-                    if (v1.type == NUMBER_TYPE) {
-                        stackPush(vm, MAKE_NUMBER(v1.content.number_value + v2.content.number_value));
+                    if (IS_NUMERIC(v1) && IS_NUMERIC(v2)) {
+                        quicken(vm, OP_ADD_NUM_GUARDED);
+                        stackPush(vm, addNumbers(v1, v2));
+                    } else if (v1.type != OBJECT_STRING_TYPE || v2.type != OBJECT_STRING_TYPE) {
+                        return operandTypeError(vm, v1, v2, "Unsupported operand type.");
                     } else {
-                        String_Object* a = v1.content.string_object;
-                        String_Object* b = v2.content.string_object;
-                        int length = a->length + b->length;
-                        char* chars = ALLOCATE(char, length + 1);
-                        memcpy(chars, a->cString, a->length);
-                        memcpy(chars + a->length, b->cString, b->length);
-                        chars[length] = '\0';
-                        stackPush(vm, makeStrValue(chars, length));
+                        quicken(vm, OP_ADD_STR_GUARDED);
+                        stackPush(vm, concatStrValues(&vm->strings, v1.content.string_object, v2.content.string_object));
                     }
                     break;
             }
             case OP_SUBTRACT: {
                 Value v2 = stackPop(vm); Value v1 = stackPop(vm);
-                if (v1.type != v2.type) return runtimeError(vm, "Cannot perform binary operation on values of different types.");
-                if (v1.type != NUMBER_TYPE) return runtimeError(vm, "Unsupported operand type.");
-
-                stackPush(vm, MAKE_NUMBER(v1.content.number_value - v2.content.number_value));
+                if (!IS_NUMERIC(v1) || !IS_NUMERIC(v2)) return operandTypeError(vm, v1, v2, "Unsupported operand type.");
+                quicken(vm, OP_SUBTRACT_NUM_GUARDED);
+                stackPush(vm, subtractNumbers(v1, v2));
                 break;
             }
             case OP_MULTIPLY: {
                 Value v2 = stackPop(vm); Value v1 = stackPop(vm);
-                if (v1.type != v2.type) return runtimeError(vm, "Cannot perform binary operation on values of different types.");
-                if (v1.type != NUMBER_TYPE) return runtimeError(vm, "Unsupported operand type.");
-
-                stackPush(vm, MAKE_NUMBER(v1.content.number_value * v2.content.number_value));
+                if (!IS_NUMERIC(v1) || !IS_NUMERIC(v2)) return operandTypeError(vm, v1, v2, "Unsupported operand type.");
+                quicken(vm, OP_MULTIPLY_NUM_GUARDED);
+                stackPush(vm, multiplyNumbers(v1, v2));
                 break;
             }
             case OP_DIVIDE: {
                 Value v2 = stackPop(vm); Value v1 = stackPop(vm);
-                if (v1.type != v2.type) return runtimeError(vm, "Cannot perform binary operation on values of different types.");
-                if (v1.type != NUMBER_TYPE) return runtimeError(vm, "Unsupported operand type.");
-                stackPush(vm, MAKE_NUMBER(v1.content.number_value / v2.content.number_value));
+                if (!IS_NUMERIC(v1) || !IS_NUMERIC(v2)) return operandTypeError(vm, v1, v2, "Unsupported operand type.");
+                quicken(vm, OP_DIVIDE_NUM_GUARDED);
+                stackPush(vm, divideNumbers(v1, v2));
                 break;
             }
             case OP_EXPONENT: {
                 Value v2 = stackPop(vm); Value v1 = stackPop(vm);
-                if (v1.type != v2.type) return runtimeError(vm, "Cannot perform binary operation on values of different types.");
-                if (v1.type != NUMBER_TYPE) return runtimeError(vm, "Unsupported operand type.");
-                stackPush(vm, MAKE_NUMBER(exponent(v1.content.number_value, v2.content.number_value)));
+                if (!IS_NUMERIC(v1) || !IS_NUMERIC(v2)) return operandTypeError(vm, v1, v2, "Unsupported operand type.");
+                stackPush(vm, powerNumbers(v1, v2));
                 break;
             }
             case OP_MOD: {
                 Value v2 = stackPop(vm); Value v1 = stackPop(vm);
-                if (v1.type != v2.type) return runtimeError(vm, "Cannot perform binary operation on values of different types.");
-                if (v1.type != NUMBER_TYPE) return runtimeError(vm, "Unsupported operand type.");
-                stackPush(vm, MAKE_NUMBER(remainder(v1.content.number_value, v2.content.number_value)));
+                if (!IS_NUMERIC(v1) || !IS_NUMERIC(v2)) return operandTypeError(vm, v1, v2, "Unsupported operand type.");
+                stackPush(vm, modNumbers(v1, v2));
+                break;
+            }
+            // Compiler proved both operands are numbers, the result overwrites the left operand.
+            case OP_ADD_NUM: NUMBER_BINARY(addNumbers); break;
+            case OP_SUBTRACT_NUM: NUMBER_BINARY(subtractNumbers); break;
+            case OP_MULTIPLY_NUM: NUMBER_BINARY(multiplyNumbers); break;
+            case OP_DIVIDE_NUM: NUMBER_BINARY(divideNumbers); break;
+            case OP_GREATER_NUM: NUMBER_BINARY(greaterNumbers); break;
+            case OP_LESS_NUM: NUMBER_BINARY(lessNumbers); break;
+            case OP_ADD_NUM_GUARDED: GUARDED_NUMBER_BINARY(addNumbers, OP_ADD); break;
+            case OP_SUBTRACT_NUM_GUARDED: GUARDED_NUMBER_BINARY(subtractNumbers, OP_SUBTRACT); break;
+            case OP_MULTIPLY_NUM_GUARDED: GUARDED_NUMBER_BINARY(multiplyNumbers, OP_MULTIPLY); break;
+            case OP_DIVIDE_NUM_GUARDED: GUARDED_NUMBER_BINARY(divideNumbers, OP_DIVIDE); break;
+            case OP_GREATER_NUM_GUARDED: GUARDED_NUMBER_BINARY(greaterNumbers, OP_GREATER); break;
+            case OP_LESS_NUM_GUARDED: GUARDED_NUMBER_BINARY(lessNumbers, OP_LESS); break;
+            case OP_ADD_STR_GUARDED: {
+                Value v2 = vm->stackTop[-1]; Value v1 = vm->stackTop[-2];
+                if (v1.type != OBJECT_STRING_TYPE || v2.type != OBJECT_STRING_TYPE) {
+                    deoptimize(vm, OP_ADD);
+                    break;
+                }
+                vm->stackTop -= 2;
+                stackPush(vm, concatStrValues(&vm->strings, v1.content.string_object, v2.content.string_object));
                 break;
             }
             case OP_NEGATE: {
                 Value v = stackPop(vm);
                 if (v.type == BOOL_TYPE) {
                     stackPush(vm, MAKE_BOOL(!v.content.bool_value));
-                } else if (v.type == NUMBER_TYPE) {
-                    stackPush(vm, MAKE_NUMBER(-v.content.number_value));
+                } else if (IS_NUMERIC(v)) {
+                    stackPush(vm, negateNumber(v));
                 } else {
                     return runtimeError(vm, "Unsupported operand type.");
                 }
@@ -399,7 +919,7 @@ OperationResult run(VM* vm){
                 break;
             }
             case OP_JUMP: {
-                if (!jump(vm)) return runtimeError(vm, "Jump address out of bound.");
+                jump(vm);
                 break;
             }
             case OP_JUMP_IF_FALSE: {
@@ -408,7 +928,7 @@ OperationResult run(VM* vm){
                     return runtimeError(vm, "Invalid jump condition, condition must be bool.");
                 }
                 if (!v.content.bool_value) {
-                    if (!jump(vm)) return runtimeError(vm, "Jump address out of bound.");
+                    jump(vm);
                 } else { // Skip jump address
                     vm->instruction_pointer += 2;
                 }
@@ -420,7 +940,7 @@ OperationResult run(VM* vm){
                     return runtimeError(vm, "Invalid jump condition, condition must be bool.");
                 }
                 if (!v.content.bool_value) {
-                    if (!jump(vm)) return runtimeError(vm, "Jump address out of bound.");
+                    jump(vm);
                 } else { // Skip jump address
                     vm->instruction_pointer += 2;
                 }
@@ -432,14 +952,107 @@ OperationResult run(VM* vm){
                     return runtimeError(vm, "Invalid jump condition, condition must be bool.");
                 }
                 if (v.content.bool_value) {
-                    if (!jump(vm)) return runtimeError(vm, "Jump address out of bound.");
+                    jump(vm);
                 } else { // Skip jump address
                     vm->instruction_pointer += 2;
                 }
                 break;
             }
             case OP_RA_PUSH: {
-                raStackPush(vm, current_chunk->constant_array.values[*vm->instruction_pointer++]);
+                // Returns past the 3 byte OP_JUMP to the callee
+                int return_address = (int)(vm->instruction_pointer - vm->code) + 3;
+                if (!raStackPush(vm, MAKE_NUMBER(return_address))) {
+                    return runtimeError(vm, "");
+                }
+                break;
+            }
+            case OP_CALL_NATIVE: {
+                const Native* native = &vm->runtime->natives[*vm->instruction_pointer++];
+                // The arguments stay where they are, the result takes their place
+                Value* args = vm->stackTop - native->arity;
+                Value result;
+                if (!native->function(vm, args, &result)) {
+                    return runtimeError(vm, "");
+                }
+                vm->stackTop = args;
+                stackPush(vm, result);
+                break;
+            }
+            case OP_TAIL_CALL: {
+                // Keeps the caller's return address, the callee returns straight to it
+                dropFrameForTailCall(vm, *vm->instruction_pointer++);
+                jump(vm);
+                break;
+            }
+            case OP_MEMO_LOOKUP: {
+                MemoTable* memo = &vm->memos[vm->instruction_pointer[0]];
+                int operand_count = vm->instruction_pointer[1];
+                Value key_name = current_chunk->constant_array.values[vm->instruction_pointer[2]];
+                vm->instruction_pointer += 3;
+                char key[MEMO_OPERAND_LIMIT * (1 + sizeof(Value))];
+                int length = memoKey(vm, operand_count, key);
+                if (length < 0) {
+                    memo->misses++;
+                    setLocal(vm, key_name, MAKE_NONE);
+                    break;
+                }
+                // A key never interned can't be in the table
+                String_Object* interned = findInternedString(&vm->strings, key, length);
+                Value result;
+                if (interned != NULL && tableGet(&memo->entries, MAKE_OBJ_STRING(interned), &result)) {
+                    memo->hits++;
+                    returnFromFunction(vm, result);
+                    break;
+                }
+                memo->misses++;
+                // The key is kept in a local until the result gets stored, unless the table is full
+                Value memo_key = memo->entries.count < vm->memo_limit ? makeStrValue(&vm->strings, key, length) : MAKE_NONE;
+                setLocal(vm, key_name, memo_key);
+                break;
+            }
+            case OP_MEMO_STORE: {
+                MemoTable* memo = &vm->memos[*vm->instruction_pointer++];
+                Value key_name = current_chunk->constant_array.values[*vm->instruction_pointer++];
+                Value memo_key;
+                if (getLocal(vm, key_name, &memo_key) && memo_key.type == OBJECT_STRING_TYPE &&
+                    memo->entries.count < vm->memo_limit) {
+                    tableSet(&memo->entries, memo_key, stackPeek(vm));
+                }
+                break;
+            }
+            case OP_FOR_RANGE_ENTER:
+            case OP_FOR_RANGE_ENTER_VAR: {
+                Value* range[3];
+                if (!rangeVariables(vm, curr_instruction == OP_FOR_RANGE_ENTER_VAR, range)) return runtimeError(vm, "");
+                if (!IS_NUMERIC(*range[0]) || !IS_NUMERIC(*range[1])) {
+                    return runtimeError(vm, "Range bounds must be numbers.");
+                }
+                // Rejects NaN too, it would never reach the limit
+                if (!IS_NUMERIC(*range[2]) || !(AS_DOUBLE(*range[2]) > 0 || AS_DOUBLE(*range[2]) < 0)) {
+                    return runtimeError(vm, "Range step must be a non-zero number.");
+                }
+                if (inRange(*range[0], *range[1], *range[2])) {
+                    vm->instruction_pointer += 2;
+                } else {
+                    jump(vm);
+                }
+                break;
+            }
+            case OP_FOR_RANGE:
+            case OP_FOR_RANGE_VAR: {
+                // Steps, compares & jumps back to the body in one dispatch
+                Value* range[3];
+                if (!rangeVariables(vm, curr_instruction == OP_FOR_RANGE_VAR, range)) return runtimeError(vm, "");
+                // The body may have assigned the loop variable
+                if (!IS_NUMERIC(*range[0])) {
+                    return runtimeError(vm, "Range loop variable must stay a number.");
+                }
+                *range[0] = addNumbers(*range[0], *range[2]);
+                if (inRange(*range[0], *range[1], *range[2])) {
+                    jump(vm);
+                } else {
+                    vm->instruction_pointer += 2;
+                }
                 break;
             }
             case OP_RV_POP: {
@@ -450,12 +1063,7 @@ OperationResult run(VM* vm){
                 if (vm->scope == 0) {
                     return RUNTIME_SUCCESS;
                 } else { // Jump to return addr
-                    // Pop return value
-                    vm->returnValue = stackPop(vm);
-                    // Clean up scope
-                    cleanLocalsAtScope(vm);
-                    vm->scope-=1;
-                    vm->instruction_pointer = &vm->chunk->bytecode_array[(int) raStackPop(vm).content.number_value];
+                    returnFromFunction(vm, stackPop(vm));
                 }
                 break;
             }
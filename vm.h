@@ -7,8 +7,15 @@
 
 #include "chunk.h"
 #include "hashTable.h"
+#include "memory.h"
+#include "runtime.h"
+#include "object.h"
 
-#define STACK_LIMIT 256
+#define STACK_INITIAL_SIZE 256
+#define DEFAULT_MAX_CALL_DEPTH 100000
+#define DEFAULT_MEMO_LIMIT 65536
+// Heap size of the first collection, later ones run once the heap doubled since the last
+#define GC_INITIAL_THRESHOLD (1024 * 1024)
 
 typedef struct{
     Value key;
@@ -17,25 +24,61 @@ typedef struct{
 } Local;
 
 typedef struct {
-    Chunk* chunk;
+    Value value;
+    bool defined;
+} Global;
+
+// Results of a memoized function, keyed by its operands
+typedef struct {
+    Table entries;
+    int hits;
+    int misses;
+} MemoTable;
+
+typedef struct VM {
+    // Runtime the chunk got compiled in
+    Runtime* runtime;
+    // Shared with the other VMs running it, never written
+    const Chunk* chunk;
+    // Bytecode being executed, the chunk's until the VM quickens an instruction & runs a copy of its own
+    uint8_t* code;
+    // Times each quickened instruction fell back to its generic form, allocated on the first fallback
+    uint8_t* deopt_counts;
     uint8_t* instruction_pointer;
-    // VM stack
-    Value stack[STACK_LIMIT];
-    int stack_index;
+    // Strings the VM creates, layered over the runtime's so the ones in the chunk keep their pointers
+    StringSet strings;
+    // VM stack, grown at function entry to fit the callee's frame
+    Value* stack;
+    int stack_capacity;
     Value* stackTop;
     // Function callstack
-    Value ra_stack[STACK_LIMIT];
+    Value* ra_stack;
     int ra_stack_index;
+    int ra_stack_capacity;
     Value* ra_stackTop;
+    int max_call_depth;
     // Local array
-    Local locals[STACK_LIMIT];
+    Local* locals;
     int local_index;
+    int locals_capacity;
 
     Value returnValue;
 
     bool hasError;
     int scope;
-    Table globals;
+    // Global variables, indexed by the slots assigned by the compiler
+    Global* globals;
+    int global_count;
+    Heap heap;
+    // Objects allocated by the VM, swept once unreachable
+    Object* objects;
+    // Heap size at which the next collection runs, and collections so far
+    size_t next_gc;
+    int gc_count;
+    // One per memoized function, each holding at most memo_limit results
+    MemoTable* memos;
+    int memo_count;
+    int memo_limit;
 } VM;
 
 typedef enum {
@@ -44,7 +87,20 @@ typedef enum {
     RUNTIME_SUCCESS,
 } OperationResult;
 
-void initVM(VM* vm, Chunk* chunk);
+// Number of values on the VM stack
+#define STACK_HEIGHT(vm) ((int)((vm)->stackTop - (vm)->stack))
+
+void initVM(VM* vm, Runtime* runtime, const Chunk* chunk);
+void freeVM(VM* vm);
+// Puts the VM back in the state initVM left it in, keeping the memory it grew & the code it quickened
+void resetVM(VM* vm);
 OperationResult run(VM* vm);
+// Reports an error raised by a native function, returns false for it to hand back
+bool nativeError(VM* vm, const char* message);
+// Allocates an empty list, may collect garbage first: values must be reachable from the VM to survive
+List_Object* newList(VM* vm, int capacity);
+Map_Object* newMap(VM* vm);
+// Allocates an array of count zeros, may collect garbage first like newList
+Array_Object* newArray(VM* vm, int count);
 
 #endif //CJLANG_VM_H